@@ -0,0 +1,50 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Rutinas de medición de rendimiento (microbenchmarks) basadas en
+ * el contador de marcas de tiempo del procesador (RDTSC).
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+/**
+ * @brief Calcula los ciclos transcurridos desde una marca de tiempo.
+ * @param start Valor de rdtsc() al iniciar la medición
+ * @return Ciclos transcurridos, saturados a 32 bits
+ */
+unsigned int bench_cycles(unsigned long long start);
+
+/**
+ * @brief Mide la asignación de marcos en un mapa de bits fragmentado de
+ * 4 GB (un bit por marco de 4 KB), con bitmap_allocate y con la búsqueda
+ * bit a bit original, e imprime los ciclos por marco de cada una.
+ */
+void bench_bitmap(void);
+
+/**
+ * @brief Mide el costo de recargar el TLB luego de recargar CR3, al leer
+ * páginas del kernel marcadas como globales (PGE activo) y sin PGE, e
+ * imprime los ciclos por recarga de cada caso.
+ */
+void bench_tlb(void);
+
+/**
+ * @brief Mide el camino rápido del manejador de fallo de página: escribe en
+ * cada página de una región reservada con kmem_reserve, sin KMEM_ZEROED y
+ * con él, e imprime los ciclos por fallo y por acceso a una página ya
+ * mapeada.
+ */
+void bench_fault(void);
+
+/**
+ * @brief Compara kmalloc / kfree con la reserva de una página por
+ * solicitud (kmem_allocate_pages), para varios tamaños de bloque. Imprime
+ * los ciclos por reserva y liberación, y la memoria que ocupan los
+ * bloques frente a la que corresponde a los datos solicitados.
+ */
+void bench_kmalloc(void);
+
+#endif /* BENCH_H_ */
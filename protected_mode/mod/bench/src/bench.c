@@ -0,0 +1,373 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Implementación de las rutinas de medición de rendimiento.
+ */
+
+#include <asm.h>
+#include <bench.h>
+#include <bitmap.h>
+#include <console.h>
+#include <kmalloc.h>
+#include <kmem.h>
+#include <paging.h>
+
+/** @brief Bits del mapa de prueba: un bit por marco de 4 KB en 4 GB */
+#define BENCH_BITMAP_SLOTS (1024 * 1024)
+
+/** @brief Al fragmentar el mapa se deja libre uno de cada 97 marcos */
+#define BENCH_BITMAP_STRIDE 97
+
+/** @brief Marcos asignados en cada medición */
+#define BENCH_BITMAP_ROUNDS 1024
+
+/** @brief Recargas de CR3 en la medición del TLB */
+#define BENCH_TLB_ROUNDS 64
+
+/** @brief Páginas de la región reservada en la medición de fallos */
+#define BENCH_FAULT_PAGES 64
+
+/** @brief Bloques reservados de cada tamaño en la medición de kmalloc */
+#define BENCH_KMALLOC_BLOCKS 128
+
+/** @brief Número de tamaños de bloque de la medición de kmalloc */
+#define BENCH_KMALLOC_SIZES 4
+
+/** @brief Tamaños de bloque de la medición de kmalloc */
+static unsigned int bench_kmalloc_sizes[BENCH_KMALLOC_SIZES] =
+    {24, 100, 700, 1800};
+
+/** @brief Bloques reservados en la medición de kmalloc */
+static unsigned int bench_blocks[BENCH_KMALLOC_BLOCKS];
+
+/** @brief Entradas del mapa de bits de prueba (128 KB) */
+static unsigned int bench_bitmap_data[BENCH_BITMAP_SLOTS / BITS_PER_BITMAP_ENTRY];
+
+/**
+ * @brief Calcula los ciclos transcurridos desde una marca de tiempo.
+ */
+unsigned int bench_cycles(unsigned long long start) {
+    unsigned long long elapsed;
+
+    elapsed = rdtsc() - start;
+
+    if (elapsed > 0xFFFFFFFFULL) {
+        return 0xFFFFFFFF;
+    }
+    return (unsigned int)elapsed;
+}
+
+/**
+ * @brief Marca todo el mapa como asignado y libera uno de cada
+ * BENCH_BITMAP_STRIDE bits, para simular una memoria fragmentada.
+ */
+static void bench_bitmap_fragment(bitmap * map) {
+    int i;
+    int slot;
+
+    bitmap_init(map, bench_bitmap_data, BENCH_BITMAP_SLOTS);
+
+    for (i = 0; i < map->total_entries; i++) {
+        bench_bitmap_data[i] = 0;
+    }
+    map->free_slots = 0;
+
+    for (slot = BENCH_BITMAP_STRIDE - 1; slot < BENCH_BITMAP_SLOTS;
+            slot += BENCH_BITMAP_STRIDE) {
+        bitmap_free(map, slot);
+    }
+    map->last_free = -1;
+}
+
+/**
+ * @brief Búsqueda original de bitmap_allocate: salta las entradas en cero
+ * una a una y prueba los 32 bits de la entrada encontrada con BITMAP_TEST.
+ * Se conserva como referencia para la medición.
+ */
+static int bench_bitmap_allocate_bits(bitmap * dst) {
+    int entry;
+    int start_entry;
+    int offset;
+
+    if (dst->free_slots == 0) {return -1;}
+
+    entry = ((dst->last_free + 1) % dst->total_slots) / BITS_PER_BITMAP_ENTRY;
+    start_entry = entry;
+
+    do {
+        if (dst->data[entry] != 0) {
+            offset = 0;
+            while (offset < BITS_PER_BITMAP_ENTRY) {
+                if (BITMAP_TEST(dst, entry, offset)) {
+                    BITMAP_CLEAR(dst, entry, offset);
+                    dst->free_slots--;
+                    return ((entry * BITS_PER_BITMAP_ENTRY) + offset);
+                }
+                offset++;
+            }
+        }
+        entry = (entry + 1) % dst->total_entries;
+    }while (entry != start_entry);
+
+    return -1;
+}
+
+/**
+ * @brief Mide la asignación de marcos en un mapa de bits fragmentado.
+ */
+void bench_bitmap(void) {
+    bitmap map;
+    unsigned long long start;
+    unsigned int bits_cycles;
+    unsigned int scan_cycles;
+    int i;
+
+    bench_bitmap_fragment(&map);
+    start = rdtsc();
+    for (i = 0; i < BENCH_BITMAP_ROUNDS; i++) {
+        if (bench_bitmap_allocate_bits(&map) < 0) {
+            break;
+        }
+    }
+    bits_cycles = bench_cycles(start);
+
+    bench_bitmap_fragment(&map);
+    start = rdtsc();
+    for (i = 0; i < BENCH_BITMAP_ROUNDS; i++) {
+        if (bitmap_allocate(&map) < 0) {
+            break;
+        }
+    }
+    scan_cycles = bench_cycles(start);
+
+    console_printf("bitmap: %d frames, 4 GB map, 1 free every %d\n",
+            BENCH_BITMAP_ROUNDS, BENCH_BITMAP_STRIDE);
+    console_printf("  bit by bit: %u cycles/frame\n",
+            bits_cycles / BENCH_BITMAP_ROUNDS);
+    console_printf("  bsf + scasd: %u cycles/frame\n",
+            scan_cycles / BENCH_BITMAP_ROUNDS);
+}
+
+/**
+ * @brief Recarga CR3 y lee una palabra de cada página del mapa de bits de
+ * prueba, ubicado en el espacio de direcciones del kernel.
+ * @return Ciclos de BENCH_TLB_ROUNDS recargas y recorridos
+ */
+static unsigned int bench_tlb_rounds(void) {
+    unsigned long long start;
+    unsigned int cr3;
+    unsigned int addr;
+    unsigned int end;
+    int i;
+
+    addr = (unsigned int)bench_bitmap_data;
+    end = addr + sizeof(bench_bitmap_data);
+
+    start = rdtsc();
+    for (i = 0; i < BENCH_TLB_ROUNDS; i++) {
+        inline_assembly("movl %%cr3, %0\n\t"
+                "movl %0, %%cr3"
+                : "=r" (cr3) : : "memory");
+        for (addr = (unsigned int)bench_bitmap_data; addr < end;
+                addr += PAGE_SIZE) {
+            (void)*(volatile unsigned int *)addr;
+        }
+    }
+    return bench_cycles(start);
+}
+
+/**
+ * @brief Mide el costo de recargar el TLB luego de recargar CR3, con las
+ * páginas del kernel globales (PGE activo) y sin ellas.
+ */
+void bench_tlb(void) {
+    unsigned int flags;
+    unsigned int cr4;
+    unsigned int global_cycles;
+    unsigned int local_cycles;
+    int pages;
+
+    if (!(cpu_features() & CPUID_FEAT_EDX_PGE)) {
+        console_printf("tlb: PGE not supported\n");
+        return;
+    }
+
+    pages = sizeof(bench_bitmap_data) / PAGE_SIZE;
+
+    flags = disable_interrupts();
+
+    inline_assembly("movl %%cr4, %0" : "=r" (cr4));
+
+    /* Con PGE activo, la recarga de CR3 conserva las páginas globales */
+    inline_assembly("movl %0, %%cr4" : : "r" (cr4 | CR4_PGE) : "memory");
+    bench_tlb_rounds();
+    global_cycles = bench_tlb_rounds();
+
+    /* Sin PGE, la recarga de CR3 invalida todas las entradas */
+    inline_assembly("movl %0, %%cr4" : : "r" (cr4 & ~CR4_PGE) : "memory");
+    local_cycles = bench_tlb_rounds();
+
+    inline_assembly("movl %0, %%cr4" : : "r" (cr4) : "memory");
+
+    restore_interrupts(flags);
+
+    console_printf("tlb: CR3 reload + %d kernel pages\n", pages);
+    console_printf("  global (PGE): %u cycles/reload\n",
+            global_cycles / BENCH_TLB_ROUNDS);
+    console_printf("  not global: %u cycles/reload\n",
+            local_cycles / BENCH_TLB_ROUNDS);
+}
+
+/**
+ * @brief Escribe una palabra en cada página de una región.
+ * @param addr Dirección de inicio de la región
+ * @param pages Número de páginas
+ * @return Ciclos empleados
+ */
+static unsigned int bench_touch_pages(unsigned int addr, int pages) {
+    unsigned long long start;
+    int i;
+
+    start = rdtsc();
+    for (i = 0; i < pages; i++, addr += PAGE_SIZE) {
+        *(volatile unsigned int *)addr = i;
+    }
+    return bench_cycles(start);
+}
+
+/**
+ * @brief Mide el primer acceso a una región reservada con kmem_reserve
+ * (fallo de página resuelto por kmem) y lo compara con un acceso a la
+ * misma página ya mapeada.
+ * @param flags Opciones de kmem_reserve (0 | KMEM_ZEROED)
+ */
+static void bench_fault_region(int flags) {
+    unsigned int addr;
+    unsigned int fault_cycles;
+    unsigned int mapped_cycles;
+    unsigned int irq_flags;
+
+    addr = kmem_reserve(BENCH_FAULT_PAGES * PAGE_SIZE, flags);
+    if (addr == 0) {
+        console_printf("fault: kmem_reserve failed\n");
+        return;
+    }
+
+    irq_flags = disable_interrupts();
+    fault_cycles = bench_touch_pages(addr, BENCH_FAULT_PAGES);
+    mapped_cycles = bench_touch_pages(addr, BENCH_FAULT_PAGES);
+    restore_interrupts(irq_flags);
+
+    kmem_release(addr);
+
+    console_printf("  %s: %u cycles/fault, %u cycles/mapped access\n",
+            (flags & KMEM_ZEROED) ? "zeroed" : "plain",
+            fault_cycles / BENCH_FAULT_PAGES,
+            mapped_cycles / BENCH_FAULT_PAGES);
+}
+
+/**
+ * @brief Mide el camino rápido del manejador de fallo de página para las
+ * regiones reservadas con kmem_reserve.
+ */
+void bench_fault(void) {
+    console_printf("fault: first write to %d reserved pages\n",
+            BENCH_FAULT_PAGES);
+    bench_fault_region(0);
+    bench_fault_region(KMEM_ZEROED);
+}
+
+/**
+ * @brief Reserva y libera BENCH_KMALLOC_BLOCKS bloques de un tamaño con
+ * kmalloc / kfree, o con una página por bloque (kmem_allocate_pages /
+ * kmem_free).
+ * @param size Tamaño de cada bloque
+ * @param pages 1 para usar páginas, 0 para usar kmalloc
+ * @param used Bytes de memoria que ocupan los bloques en uso
+ * @return Ciclos por reserva y liberación
+ */
+static unsigned int bench_kmalloc_size(unsigned int size, int pages,
+        unsigned int * used) {
+    unsigned long long start;
+    unsigned int cycles;
+    unsigned int reserved;
+    int i;
+
+    reserved = kmalloc_usage.reserved;
+
+    start = rdtsc();
+    for (i = 0; i < BENCH_KMALLOC_BLOCKS; i++) {
+        if (pages) {
+            bench_blocks[i] = kmem_allocate_pages(1, KMEM_SPARSE);
+        }else {
+            bench_blocks[i] = (unsigned int)kmalloc(size);
+        }
+    }
+    cycles = bench_cycles(start);
+
+    /* Cada bloque ocupa una página completa, o el bloque de su clase */
+    if (pages) {
+        *used = 0;
+        for (i = 0; i < BENCH_KMALLOC_BLOCKS; i++) {
+            if (bench_blocks[i] != 0) {
+                *used += PAGE_SIZE;
+            }
+        }
+    }else {
+        *used = kmalloc_usage.reserved - reserved;
+    }
+
+    start = rdtsc();
+    for (i = 0; i < BENCH_KMALLOC_BLOCKS; i++) {
+        if (bench_blocks[i] == 0) {
+            continue;
+        }
+        if (pages) {
+            kmem_free(bench_blocks[i]);
+        }else {
+            kfree((void *)bench_blocks[i]);
+        }
+    }
+    cycles += bench_cycles(start);
+
+    return cycles / BENCH_KMALLOC_BLOCKS;
+}
+
+/**
+ * @brief Compara kmalloc con la reserva de una página por solicitud.
+ */
+void bench_kmalloc(void) {
+    unsigned int size;
+    unsigned int requested;
+    unsigned int kmalloc_cycles;
+    unsigned int kmalloc_used;
+    unsigned int pages_cycles;
+    unsigned int pages_used;
+    int i;
+
+    console_printf("kmalloc: %d blocks, cycles per alloc + free, "
+            "KB in use\n", BENCH_KMALLOC_BLOCKS);
+
+    for (i = 0; i < BENCH_KMALLOC_SIZES; i++) {
+        size = bench_kmalloc_sizes[i];
+        requested = BENCH_KMALLOC_BLOCKS * size;
+
+        /* Crear el almacén de la clase antes de medir */
+        kfree(kmalloc(size));
+
+        kmalloc_cycles = bench_kmalloc_size(size, 0, &kmalloc_used);
+        pages_cycles = bench_kmalloc_size(size, 1, &pages_used);
+
+        if (kmalloc_used == 0 || pages_used == 0) {
+            console_printf("  %u B: out of memory\n", size);
+            continue;
+        }
+
+        console_printf("  %u B (%u KB data): kmalloc %u cycles %u KB, "
+                "pages %u cycles %u KB\n",
+                size, requested / 1024, kmalloc_cycles, kmalloc_used / 1024,
+                pages_cycles, pages_used / 1024);
+    }
+}
@@ -15,6 +15,14 @@
 #define BITMAP_CLEAR(dst, entry, offset) dst->data[entry] &= ~(1<<offset)
 #define BITMAP_TEST(dst, entry, offset) (dst->data[entry] & (1<<offset))
 
+/** @brief Numero de entradas del resumen de un mapa de bits de 'bits' bits:
+ * un bit del resumen por cada entrada del mapa. */
+#define BITMAP_SUMMARY_ENTRIES(bits) \
+    ((((bits) / BITS_PER_BITMAP_ENTRY) + BITS_PER_BITMAP_ENTRY - 1) \
+     / BITS_PER_BITMAP_ENTRY)
+
+#include <asm.h>
+
 /** @brief Descriptor de mapa de bits */
 typedef struct {	
   /** @brief apuntador al mapa de bits */
@@ -27,8 +35,62 @@ typedef struct {
 	int last_free;
   /** @brief Numero de bits libres */
 	int free_slots;
+  /** @brief Resumen de segundo nivel (opcional): el bit i indica que la
+   * entrada i del mapa tiene al menos un bit libre. */
+	unsigned int * summary;
+  /** @brief Entradas del resumen de segundo nivel */
+	int summary_entries;
+  /** @brief Resumen de tercer nivel (opcional): el bit j indica que la
+   * entrada j de summary es diferente de cero. */
+	unsigned int * summary2;
+  /** @brief Entradas del resumen de tercer nivel */
+	int summary2_entries;
 }bitmap;
 
+/** @brief Retorna la posición del primer bit en 1 de una entrada del mapa
+ * de bits, usando la instrucción BSF.
+ * @param value Entrada del mapa de bits. Debe ser diferente de cero.
+ * @return Posición (0..31) del bit menos significativo en 1
+ */
+static __inline__ int bitmap_first_set(unsigned int value) {
+    int bit;
+    inline_assembly("bsf %1, %0" : "=r" (bit) : "rm" (value) : "cc");
+    return bit;
+}
+
+/** @brief Busca la primera entrada diferente de cero (con al menos un bit
+ * libre) en el rango [from, to) del mapa de bits. Usa REPE SCASD para
+ * saltar las entradas completas en cero sin probar sus bits uno a uno.
+ * @param data Apuntador a las entradas del mapa de bits
+ * @param from Primera entrada a revisar
+ * @param to Entrada en la cual termina la busqueda (no se revisa)
+ * @return Indice de la entrada encontrada, to si todas están en cero
+ */
+static __inline__ int bitmap_scan_entries(unsigned int * data,
+        int from, int to) {
+    unsigned int * ptr;
+    int count;
+
+    if (from >= to) {
+        return to;
+    }
+
+    ptr = data + from;
+    count = to - from;
+
+    inline_assembly("cld\n\t"
+                    "repe scasl"
+                    : "+D" (ptr), "+c" (count)
+                    : "a" (0)
+                    : "memory", "cc");
+
+    /* SCASD avanza EDI incluso sobre la entrada que detuvo la busqueda */
+    if (*(ptr - 1) != 0) {
+        return (ptr - 1) - data;
+    }
+    return to;
+}
+
 /** @brief Inicializa un mapa de bits.
  *  @param dst Apuntador al descriptor de mapa de bits  
  *  @param data Region de memoria del mapa de bits
@@ -39,6 +101,22 @@ int bitmap_init(bitmap * dst,
 									unsigned int * data, 
 									int total_bits);
                   
+/** @brief Adiciona un resumen jerarquico a un mapa de bits ya inicializado.
+ * Con el resumen, la busqueda de un bit libre no recorre las entradas
+ * llenas del mapa una a una, sino que salta directamente a la siguiente
+ * entrada con bits libres.
+ *  @param dst Apuntador al descriptor de mapa de bits
+ *  @param summary Memoria para el segundo nivel, de
+ *  BITMAP_SUMMARY_ENTRIES(dst->total_slots) entradas
+ *  @param summary2 Memoria para el tercer nivel, de
+ *  BITMAP_SUMMARY_ENTRIES(BITMAP_SUMMARY_ENTRIES(dst->total_slots) *
+ *  BITS_PER_BITMAP_ENTRY) entradas, o 0 para usar solo dos niveles
+ *  @return 0 
+ */
+int bitmap_init_summary(bitmap * dst,
+                  unsigned int * summary,
+                  unsigned int * summary2);
+
 /* @brief Verifica el valor de un bit en el mapa de bits
  * @param dst Apuntador al descriptor del mapa de bits
  * @param slot Posicion del bit a verificar
@@ -47,6 +125,14 @@ int bitmap_init(bitmap * dst,
 int bitmap_test(bitmap * dst, int slot);
 
 
+/* @brief Cuenta los bits disponibles en una region del mapa de bits.
+ * @param dst Apuntador al descriptor del mapa de bits
+ * @param slot Posicion del primer bit de la region
+ * @param count Numero de bits de la region
+ * @return Numero de bits disponibles en la region
+ */
+int bitmap_count_free(bitmap * dst, int slot, int count);
+
 /* @brief Busca y limpia un bit disponible en el mapa de bits.
  * @param dst Apuntador al descriptor del mapa de bits
  * @return Posicion del bit en el mapa de bits, -1 si no hay disponible
@@ -60,6 +146,24 @@ int bitmap_allocate(bitmap * dst);
  */
 int bitmap_allocate_region(bitmap * dst, int count);
 
+/* @brief Busca y limpia una region alineada de bits en el mapa de bits.
+ * La region se busca y se marca como usada una entrada completa a la vez.
+ * @param dst Apuntador al descriptor del mapa de bits
+ * @param count Numero de bits continuos a buscar
+ * @param align Alineacion (potencia de 2) del primer bit de la region
+ * @param base Numero que se suma a la posicion de los bits al verificar la
+ * alineacion (por ejemplo, el primer marco de una region de memoria)
+ * @return Posicion del primer bit de la region, -1 si no hay dispnible 
+ */
+int bitmap_allocate_aligned(bitmap * dst, int count, int align, int base);
+
+/* @brief Marca un bit especifico como no disponible en el mapa de bits.
+ * @param dst Apuntador al descriptor del mapa de bits
+ * @param slot Posicion del bit a reservar
+ * @return 1 si el bit estaba disponible, 0 en caso contrario
+ */
+int bitmap_reserve(bitmap * dst, int slot);
+
 /* @brief Marca un bit como disponible en el mapa de bits. 
  * @param dst Apuntador al descriptor del mapa de bits
  * @param slot Posicion del bit a liberar
@@ -75,4 +179,13 @@ int bitmap_free(bitmap * dst, int slot);
  */
 int bitmap_free_region(bitmap * dst, int slot, int count);
 
+/* @brief Marca como disponibles los bits indicados de una entrada del mapa
+ * de bits, con una sola escritura.
+ * @param dst Apuntador al descriptor del mapa de bits
+ * @param entry Entrada del mapa de bits
+ * @param mask Bits de la entrada a liberar
+ * @return Numero de bits que se liberaron (los bits ya libres se ignoran)
+ */
+int bitmap_free_mask(bitmap * dst, int entry, unsigned int mask);
+
 #endif
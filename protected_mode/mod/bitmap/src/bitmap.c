@@ -1,5 +1,110 @@
 #include <bitmap.h>
 
+/**
+ * @brief Busca el primer bit en 1 a partir de la posicion bit, en un arreglo
+ * de nwords entradas.
+ * @return Posicion del bit encontrado, -1 si no existe
+ */
+static int bitmap_next_set(unsigned int * words, int nwords, int bit) {
+    int word;
+    unsigned int value;
+
+    word = bit / BITS_PER_BITMAP_ENTRY;
+    if (word >= nwords) {
+        return -1;
+    }
+
+    value = words[word] & (~0U << (bit % BITS_PER_BITMAP_ENTRY));
+    if (value == 0) {
+        word = bitmap_scan_entries(words, word + 1, nwords);
+        if (word == nwords) {
+            return -1;
+        }
+        value = words[word];
+    }
+    return (word * BITS_PER_BITMAP_ENTRY) + bitmap_first_set(value);
+}
+
+/**
+ * @brief Busca la primera entrada del mapa con bits libres a partir de
+ * entry, usando los niveles de resumen si existen.
+ * @return Indice de la entrada, -1 si no existe
+ */
+static int bitmap_next_entry(bitmap * dst, int entry) {
+    int word;
+    unsigned int value;
+
+    if (entry >= dst->total_entries) {
+        return -1;
+    }
+
+    /* Sin resumen: saltar las entradas en cero directamente en el mapa */
+    if (dst->summary == 0) {
+        entry = bitmap_scan_entries(dst->data, entry, dst->total_entries);
+        if (entry == dst->total_entries) {
+            return -1;
+        }
+        return entry;
+    }
+
+    word = entry / BITS_PER_BITMAP_ENTRY;
+    value = dst->summary[word] & (~0U << (entry % BITS_PER_BITMAP_ENTRY));
+
+    if (value == 0) {
+        /* Ubicar la siguiente entrada del resumen diferente de cero */
+        if (dst->summary2 != 0) {
+            word = bitmap_next_set(dst->summary2, dst->summary2_entries,
+                    word + 1);
+        }else {
+            word = bitmap_scan_entries(dst->summary, word + 1,
+                    dst->summary_entries);
+            if (word == dst->summary_entries) {
+                word = -1;
+            }
+        }
+        if (word < 0) {
+            return -1;
+        }
+        value = dst->summary[word];
+    }
+
+    return (word * BITS_PER_BITMAP_ENTRY) + bitmap_first_set(value);
+}
+
+/**
+ * @brief Actualiza los niveles de resumen luego de modificar una entrada del
+ * mapa de bits.
+ */
+static void bitmap_sync_entry(bitmap * dst, int entry) {
+    int word;
+    int offset;
+
+    if (dst->summary == 0 || entry >= dst->total_entries) {
+        return;
+    }
+
+    word = entry / BITS_PER_BITMAP_ENTRY;
+    offset = entry % BITS_PER_BITMAP_ENTRY;
+
+    if (dst->data[entry] != 0) {
+        dst->summary[word] |= (1 << offset);
+    }else {
+        dst->summary[word] &= ~(1 << offset);
+    }
+
+    if (dst->summary2 == 0) {
+        return;
+    }
+
+    offset = word % BITS_PER_BITMAP_ENTRY;
+
+    if (dst->summary[word] != 0) {
+        dst->summary2[word / BITS_PER_BITMAP_ENTRY] |= (1 << offset);
+    }else {
+        dst->summary2[word / BITS_PER_BITMAP_ENTRY] &= ~(1 << offset);
+    }
+}
+
 /** 
  * @brief Inicializa un mapa de bits.
  */
@@ -17,6 +122,11 @@ int bitmap_init(bitmap * dst, unsigned int * data, int total_slots) {
     
     dst->free_slots = total_slots;
     dst->last_free = -1;
+
+    dst->summary = 0;
+    dst->summary_entries = 0;
+    dst->summary2 = 0;
+    dst->summary2_entries = 0;
     
     /* Mark BITS_PER_BITMAP_ENTRY entries at once */
     for (i = 0; i < dst->total_entries; i++) {
@@ -35,6 +145,40 @@ int bitmap_init(bitmap * dst, unsigned int * data, int total_slots) {
     return 0;
 }
 
+/**
+ * @brief Adiciona un resumen jerarquico a un mapa de bits ya inicializado.
+ */
+int bitmap_init_summary(bitmap * dst,
+        unsigned int * summary,
+        unsigned int * summary2) {
+    int i;
+
+    dst->summary = summary;
+    dst->summary_entries = BITMAP_SUMMARY_ENTRIES(dst->total_slots);
+
+    for (i = 0; i < dst->summary_entries; i++) {
+        summary[i] = 0;
+    }
+
+    if (summary2 != 0) {
+        dst->summary2 = summary2;
+        dst->summary2_entries = (dst->summary_entries 
+                + BITS_PER_BITMAP_ENTRY - 1) / BITS_PER_BITMAP_ENTRY;
+        for (i = 0; i < dst->summary2_entries; i++) {
+            summary2[i] = 0;
+        }
+    }
+
+    /* Construir el resumen a partir del contenido actual del mapa */
+    for (i = 0; i < dst->total_entries; i++) {
+        if (dst->data[i] != 0) {
+            bitmap_sync_entry(dst, i);
+        }
+    }
+
+    return 0;
+}
+
 /**
  * @brief Verifica el valor de un bit en el mapa de bits.
  */
@@ -55,11 +199,14 @@ int bitmap_test(bitmap * dst, int slot) {
 
 /**
  * @brief Busca y limpia un bit disponible en el mapa de bits.
+ * Las entradas en cero se saltan completas (REPE SCASD) y dentro de la
+ * entrada encontrada se ubica el bit libre con BSF, en lugar de probar
+ * los bits uno a uno.
  */
 int bitmap_allocate(bitmap * dst){
     unsigned int slot;  
-    unsigned int entry;
-    unsigned int start_entry;   
+    int entry;
+    int start_entry;   
     int offset; 
     
     if (dst->free_slots == 0) {return -1;}
@@ -73,7 +220,8 @@ int bitmap_allocate(bitmap * dst){
         
         if (BITMAP_TEST(dst, entry, offset)) {
             /* Allocate slot! */
-            BITMAP_SET(dst, entry, offset);
+            BITMAP_CLEAR(dst, entry, offset);
+            bitmap_sync_entry(dst, entry);
             dst->free_slots--;
             return slot;
         }
@@ -85,97 +233,239 @@ int bitmap_allocate(bitmap * dst){
     /* Walk the bitmap */
     slot = (slot + 1) % dst->total_slots;
     
-    entry = slot / BITS_PER_BITMAP_ENTRY;
-    
-    start_entry = entry;
+    start_entry = slot / BITS_PER_BITMAP_ENTRY;
+
+    if (start_entry >= dst->total_entries) {
+        start_entry = 0;
+    }
     
-    do {
-        if (dst->data[entry] != 0) {
-            //Found entry with at least one bit set!
-            offset = 0;
-            while (offset < BITS_PER_BITMAP_ENTRY) {                
-                if (BITMAP_TEST(dst, entry, offset)) {                  
-                    /* Allocate slot! */
-                    BITMAP_CLEAR(dst, entry, offset);
-                    dst->free_slots--;
-                    return ((entry * BITS_PER_BITMAP_ENTRY) + offset);
-                }
-                offset++;
-            }
+    /* Search from start_entry to the end, then wrap around */
+    entry = bitmap_next_entry(dst, start_entry);
+    if (entry < 0) {
+        entry = bitmap_next_entry(dst, 0);
+        if (entry < 0 || entry >= start_entry) {
+            return -1;
         }
-        //Advance to next entry
-        entry = (entry + 1) % dst->total_entries;       
-    }while (entry != start_entry);  
-    
-    return -1;  
+    }
+
+    //Found entry with at least one bit set!
+    offset = bitmap_first_set(dst->data[entry]);
+
+    /* Allocate slot! */
+    BITMAP_CLEAR(dst, entry, offset);
+    bitmap_sync_entry(dst, entry);
+    dst->free_slots--;
+    return ((entry * BITS_PER_BITMAP_ENTRY) + offset);
+}
+
+/**
+ * @brief Calcula la mascara de los bits de la entrada entry que pertenecen
+ * a la region [slot, end).
+ */
+static unsigned int bitmap_range_mask(int entry, int slot, int end) {
+    unsigned int mask = ~0U;
+
+    if (entry == slot / BITS_PER_BITMAP_ENTRY) {
+        mask &= ~0U << (slot % BITS_PER_BITMAP_ENTRY);
+    }
+    if (entry == (end - 1) / BITS_PER_BITMAP_ENTRY) {
+        mask &= ~0U >> (BITS_PER_BITMAP_ENTRY - 1 
+                - ((end - 1) % BITS_PER_BITMAP_ENTRY));
+    }
+    return mask;
+}
+
+/**
+ * @brief Cuenta los bits en 1 de una entrada del mapa de bits.
+ */
+static int bitmap_count_bits(unsigned int value) {
+    value = value - ((value >> 1) & 0x55555555);
+    value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+    value = (value + (value >> 4)) & 0x0F0F0F0F;
+    return (value * 0x01010101) >> 24;
+}
+
+/**
+ * @brief Busca el primer bit usado (en 0) dentro de la region
+ * [slot, slot + count), revisando una entrada completa a la vez.
+ * @return Posicion del bit usado, -1 si toda la region esta libre
+ */
+static int bitmap_first_used(bitmap * dst, int slot, int count) {
+    int entry;
+    int end;
+    unsigned int used;
+
+    end = slot + count;
+
+    for (entry = slot / BITS_PER_BITMAP_ENTRY;
+            entry <= (end - 1) / BITS_PER_BITMAP_ENTRY;
+            entry++) {
+        used = ~dst->data[entry] & bitmap_range_mask(entry, slot, end);
+        if (used != 0) {
+            return (entry * BITS_PER_BITMAP_ENTRY) + bitmap_first_set(used);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Busca una region de count bits libres, cuyo inicio sumado a base
+ * sea multiplo de align. Solo se consideran las regiones que inician en
+ * [from, limit).
+ * @return Posicion del primer bit de la region, -1 si no existe
+ */
+static int bitmap_find_region(bitmap * dst, int from, int limit,
+        int count, int align, int base) {
+    int entry;
+    int slot;
+    int used;
+    unsigned int value;
+
+    while (from < limit) {
+        /* Saltar a la siguiente entrada con bits libres */
+        entry = bitmap_next_entry(dst, from / BITS_PER_BITMAP_ENTRY);
+        if (entry < 0) {
+            return -1;
+        }
+
+        value = dst->data[entry];
+        if (entry == from / BITS_PER_BITMAP_ENTRY) {
+            value &= ~0U << (from % BITS_PER_BITMAP_ENTRY);
+        }
+        if (value == 0) {
+            from = (entry + 1) * BITS_PER_BITMAP_ENTRY;
+            continue;
+        }
+
+        /* Primer bit libre, redondeado hacia arriba a la alineacion */
+        slot = (entry * BITS_PER_BITMAP_ENTRY) + bitmap_first_set(value);
+        slot = ((slot + base + align - 1) & ~(align - 1)) - base;
+
+        if (slot >= limit || slot + count > dst->total_slots) {
+            return -1;
+        }
+
+        used = bitmap_first_used(dst, slot, count);
+        if (used < 0) {
+            return slot;
+        }
+
+        /* La region no cabe antes del bit usado, continuar despues de el */
+        from = used + 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief Cuenta los bits disponibles en una region del mapa de bits.
+ */
+int bitmap_count_free(bitmap * dst, int slot, int count) {
+    int entry;
+    int end;
+    int total;
+
+    if (slot < 0 || count <= 0) {
+        return 0;
+    }
+
+    end = slot + count;
+    if (end > dst->total_slots) {
+        end = dst->total_slots;
+    }
+
+    total = 0;
+    for (entry = slot / BITS_PER_BITMAP_ENTRY;
+            slot < end && entry <= (end - 1) / BITS_PER_BITMAP_ENTRY;
+            entry++) {
+        total += bitmap_count_bits(dst->data[entry] 
+                & bitmap_range_mask(entry, slot, end));
+    }
+    return total;
+}
+
+/**
+ * @brief Marca como usados (en 0) los bits de la region [slot, slot + count)
+ * escribiendo una entrada completa a la vez.
+ */
+static void bitmap_clear_range(bitmap * dst, int slot, int count) {
+    int entry;
+    int end;
+
+    end = slot + count;
+
+    for (entry = slot / BITS_PER_BITMAP_ENTRY;
+            entry <= (end - 1) / BITS_PER_BITMAP_ENTRY;
+            entry++) {
+        dst->data[entry] &= ~bitmap_range_mask(entry, slot, end);
+        bitmap_sync_entry(dst, entry);
+    }
 }
 
 /**
  * @brief Busca y limpia una region bit en el mapa de bits.
  */
 int bitmap_allocate_region(bitmap * dst, int count){
-    unsigned int slot;  
-    unsigned int entry;
-    unsigned int start_entry;   
-    int offset; 
-    int s;
-    int result;
-    
+    return bitmap_allocate_aligned(dst, count, 1, 0);
+}
+
+/**
+ * @brief Busca y limpia una region de bits alineada en el mapa de bits.
+ */
+int bitmap_allocate_aligned(bitmap * dst, int count, int align, int base){
+    int start;
+    int slot;
+
     //Check for available slots
-    if (count > dst->free_slots) {
+    if (count <= 0 || count > dst->free_slots) {
         return -1;
     }
-    
-    slot = dst->last_free;
-    
-    if (slot < 0 || slot >= dst->total_slots) { 
+
+    //The alignment must be a power of two
+    if (align <= 0 || (align & (align - 1)) != 0) {
+        return -1;
+    }
+
+    start = dst->last_free;
+
+    if (start < 0 || start >= dst->total_slots) { 
         //Start at the beginnig of the bitmap
-        slot = 0;
+        start = 0;
     }
-    
-    /* Walk the bitmap */
-    entry = slot / BITS_PER_BITMAP_ENTRY;   
-    start_entry = entry;
-    
-    do {
-        if (dst->data[entry] != 0) {
-            //Found entry with at least one bit set!
-            offset = 0;
-            while (offset < BITS_PER_BITMAP_ENTRY 
-                    && BITMAP_TEST(dst, entry, offset) == 0) {
-                offset++;
-            }
-            
-            slot = (entry * BITS_PER_BITMAP_ENTRY) + offset;
-            
-            if (slot + count < dst->total_slots) {
-                result = 1;
-                for (s = slot; s < slot + count; s++) {
-                    entry = s / BITS_PER_BITMAP_ENTRY;
-                    offset = s % BITS_PER_BITMAP_ENTRY;
-                    result = result && BITMAP_TEST(dst, entry, offset);
-                }
-                if (result) {
-                    for (s = slot; s < slot + count; s++) {
-                        entry = s / BITS_PER_BITMAP_ENTRY;
-                        offset = s % BITS_PER_BITMAP_ENTRY;
-                        BITMAP_CLEAR(dst, entry, offset);
-                    }
-                    dst->free_slots -= count;
-                    return slot;
-                }else {
-                    entry = (slot  + count) / BITS_PER_BITMAP_ENTRY;
-                }
-            }else {
-                entry = (entry + 1) % dst->total_entries;
-            }
-        }else {
-            //Advance to next entry
-            entry = (entry + 1) % dst->total_entries;       
+
+    /* Walk the bitmap from the last freed slot, then wrap around */
+    slot = bitmap_find_region(dst, start, dst->total_slots,
+            count, align, base);
+    if (slot < 0 && start > 0) {
+        slot = bitmap_find_region(dst, 0, start, count, align, base);
+    }
+
+    if (slot < 0) {
+        return -1;
+    }
+
+    bitmap_clear_range(dst, slot, count);
+    dst->free_slots -= count;
+    return slot;
+}
+
+/** 
+ @brief Marca un bit especifico como no disponible en el mapa de bits.
+ */
+int bitmap_reserve(bitmap * dst, int slot) {
+    int entry;
+    int offset;
+    if (slot >= 0 && slot < dst->total_slots) {
+        entry = slot / BITS_PER_BITMAP_ENTRY;
+        offset = slot % BITS_PER_BITMAP_ENTRY;
+        //Reserve only if set
+        if (BITMAP_TEST(dst, entry, offset)) {
+            BITMAP_CLEAR(dst, entry, offset);
+            bitmap_sync_entry(dst, entry);
+            dst->free_slots--;
+            return 1;
         }
-    }while (entry != start_entry);  
-    
-    return -1;  
+    }
+    return 0;
 }
 
 /** 
@@ -190,6 +480,7 @@ int bitmap_free(bitmap * dst, int slot) {
         //Free only if clear
         if (!BITMAP_TEST(dst, entry, offset)) {
             BITMAP_SET(dst, entry,offset);
+            bitmap_sync_entry(dst, entry);
             dst->free_slots++;
             dst->last_free = slot;
       return 1;
@@ -198,29 +489,53 @@ int bitmap_free(bitmap * dst, int slot) {
   return 0;  
 }
 
+/**
+ *  @brief Marca como disponibles los bits indicados de una entrada.
+ */
+int bitmap_free_mask(bitmap * dst, int entry, unsigned int mask) {
+    int count;
+    if (entry < 0 || entry * BITS_PER_BITMAP_ENTRY >= dst->total_slots) {
+        return 0;
+    }
+    //Ignore the slots beyond total_slots
+    mask &= bitmap_range_mask(entry, entry * BITS_PER_BITMAP_ENTRY,
+            dst->total_slots);
+    //Free only the slots that are clear
+    mask &= ~dst->data[entry];
+    if (mask == 0) {
+        return 0;
+    }
+    dst->data[entry] |= mask;
+    bitmap_sync_entry(dst, entry);
+    count = bitmap_count_bits(mask);
+    dst->free_slots += count;
+    dst->last_free = entry * BITS_PER_BITMAP_ENTRY + bitmap_first_set(mask);
+    return count;
+}
+
 /**
  *  @brief Marca una region como disponible en el mapa de bits.
+ *  Los bits se marcan una entrada completa a la vez.
  */
 int bitmap_free_region(bitmap * dst, int slot, int count) {
-    int s;
     int entry;
-    int offset;
-    int last_free = -1;
-    if (slot >= 0 && slot + count < dst->total_slots) {
-        for (s = slot; s < slot + count; s++) {
-            entry = s / BITS_PER_BITMAP_ENTRY;
-            offset = s % BITS_PER_BITMAP_ENTRY;
-            if (!BITMAP_TEST(dst, entry, offset)) {
-                BITMAP_SET(dst, entry,offset);
-                dst->free_slots++;
-                if (last_free == -1) {
-                    last_free = s;
-                }
+    int end;
+    unsigned int mask;
+    if (slot >= 0 && count > 0 && slot + count <= dst->total_slots) {
+        end = slot + count;
+        for (entry = slot / BITS_PER_BITMAP_ENTRY;
+                entry <= (end - 1) / BITS_PER_BITMAP_ENTRY;
+                entry++) {
+            //Free only the slots that are clear
+            mask = bitmap_range_mask(entry, slot, end) & ~dst->data[entry];
+            if (mask != 0) {
+                dst->data[entry] |= mask;
+                bitmap_sync_entry(dst, entry);
+                dst->free_slots += bitmap_count_bits(mask);
             }
         }
-        dst->last_free = last_free;
+        dst->last_free = slot;
     return 1;
     }
   return 0;
 }
-
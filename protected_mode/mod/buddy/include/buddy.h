@@ -0,0 +1,99 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Asignador de bloques por parejas (buddy) basado en mapas de bits.
+ * Cada orden k gestiona bloques de 2^k unidades alineados a 2^k, y se
+ * representa con un mapa de bits en el cual cada bit indica si el bloque
+ * correspondiente se encuentra libre.
+ */
+
+#ifndef BUDDY_H_
+#define BUDDY_H_
+
+#include <bitmap.h>
+
+/** @brief Máximo orden de un bloque (2^10 unidades = 4 MB con marcos de
+ * 4 KB) */
+#define BUDDY_MAX_ORDER 10
+
+/** @brief Número de órdenes gestionados */
+#define BUDDY_ORDERS (BUDDY_MAX_ORDER + 1)
+
+/** @brief Unidades en un bloque del orden máximo */
+#define BUDDY_MAX_BLOCK (1 << BUDDY_MAX_ORDER)
+
+/** @brief Entradas requeridas por los mapas de bits de todos los órdenes,
+ * para gestionar 'slots' unidades (cota superior) */
+#define BUDDY_BITMAP_ENTRIES(slots) \
+    ((2 * ((slots) + BUDDY_MAX_BLOCK) / BITS_PER_BITMAP_ENTRY) + BUDDY_ORDERS)
+
+/** @brief Entradas requeridas por los resúmenes de todos los órdenes, para
+ * gestionar 'slots' unidades (cota superior) */
+#define BUDDY_SUMMARY_ENTRIES(slots) \
+    (BITMAP_SUMMARY_ENTRIES(2 * ((slots) + BUDDY_MAX_BLOCK)) + BUDDY_ORDERS)
+
+/** @brief Descriptor del asignador buddy */
+typedef struct {
+  /** @brief Primera unidad gestionada, alineada a BUDDY_MAX_BLOCK */
+  unsigned int base;
+  /** @brief Unidades gestionadas a partir de base */
+  int total_slots;
+  /** @brief Unidades libres */
+  int free_slots;
+  /** @brief Bloques libres de cada orden */
+  bitmap maps[BUDDY_ORDERS];
+}buddy;
+
+/** @brief Inicializa un asignador buddy. Inicialmente todas las unidades se
+ * encuentran ocupadas, y se deben liberar con buddy_free.
+ * @param b Apuntador al descriptor
+ * @param data Memoria para los mapas de bits, de
+ * BUDDY_BITMAP_ENTRIES(count) entradas
+ * @param summary Memoria para los resúmenes de los mapas de bits, de
+ * BUDDY_SUMMARY_ENTRIES(count) entradas
+ * @param start Primera unidad a gestionar
+ * @param count Número de unidades a gestionar
+ * @return 0
+ */
+int buddy_init(buddy * b,
+               unsigned int * data,
+               unsigned int * summary,
+               unsigned int start,
+               int count);
+
+/** @brief Reserva un bloque de 2^order unidades.
+ * @param b Apuntador al descriptor
+ * @param order Orden del bloque
+ * @return Primera unidad del bloque, -1 si no existe un bloque disponible
+ */
+int buddy_alloc(buddy * b, int order);
+
+/** @brief Reserva count unidades contiguas, cuya primera unidad es múltiplo
+ * de align.
+ * @param b Apuntador al descriptor
+ * @param count Número de unidades (máximo BUDDY_MAX_BLOCK)
+ * @param align Alineación de la primera unidad (potencia de 2)
+ * @return Primera unidad de la región, -1 si no existe
+ */
+int buddy_alloc_region(buddy * b, int count, int align);
+
+/** @brief Libera count unidades contiguas, combinando los bloques libres
+ * con sus parejas. Las unidades que ya se encuentran libres se ignoran.
+ * @param b Apuntador al descriptor
+ * @param slot Primera unidad a liberar
+ * @param count Número de unidades a liberar
+ * @return Número de unidades que se liberaron
+ */
+int buddy_free(buddy * b, unsigned int slot, int count);
+
+/** @brief Cuenta las unidades libres dentro de una región.
+ * @param b Apuntador al descriptor
+ * @param slot Primera unidad de la región
+ * @param count Número de unidades de la región
+ * @return Número de unidades libres
+ */
+int buddy_available(buddy * b, unsigned int slot, int count);
+
+#endif /* BUDDY_H_ */
@@ -0,0 +1,294 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Implementación del asignador de bloques por parejas (buddy).
+ */
+
+#include <buddy.h>
+
+/**
+ * @brief Calcula el menor orden cuyo bloque contiene count unidades.
+ */
+static int buddy_order(int count) {
+    int order = 0;
+
+    while ((1 << order) < count) {
+        order++;
+    }
+    return order;
+}
+
+/**
+ * @brief Verifica si la unidad rel (relativa a base) se encuentra dentro de
+ * un bloque libre de orden mayor o igual a order.
+ */
+static int buddy_is_free(buddy * b, unsigned int rel, int order) {
+    for (; order <= BUDDY_MAX_ORDER; order++) {
+        if (bitmap_test(&b->maps[order], rel >> order)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Verifica si alguna unidad del bloque de orden order que inicia en
+ * rel se encuentra dentro de un bloque libre de orden menor.
+ */
+static int buddy_has_free_below(buddy * b, unsigned int rel, int order) {
+    int k;
+
+    for (k = 0; k < order; k++) {
+        if (bitmap_count_free(&b->maps[k], rel >> k, 1 << (order - k)) > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Libera un bloque alineado de orden order, y lo combina con su
+ * pareja mientras ésta también se encuentre libre.
+ */
+static void buddy_free_block(buddy * b, unsigned int rel, int order) {
+    unsigned int index;
+
+    index = rel >> order;
+
+    /* Si la pareja está libre, retirarla y subir al siguiente orden */
+    while (order < BUDDY_MAX_ORDER &&
+            bitmap_reserve(&b->maps[order], index ^ 1)) {
+        index >>= 1;
+        order++;
+    }
+
+    bitmap_free(&b->maps[order], index);
+}
+
+/**
+ * @brief Libera las unidades ocupadas de un bloque alineado de orden order.
+ * Si parte del bloque ya se encuentra libre en un orden menor, el bloque se
+ * divide y se libera cada mitad por separado.
+ * @return Número de unidades que se liberaron
+ */
+static int buddy_free_aligned(buddy * b, unsigned int rel, int order) {
+    /* El bloque ya se encuentra dentro de un bloque libre */
+    if (buddy_is_free(b, rel, order)) {
+        return 0;
+    }
+
+    if (order > 0 && buddy_has_free_below(b, rel, order)) {
+        return buddy_free_aligned(b, rel, order - 1)
+            + buddy_free_aligned(b, rel + (1 << (order - 1)), order - 1);
+    }
+
+    buddy_free_block(b, rel, order);
+    return (1 << order);
+}
+
+/**
+ * @brief Inicializa un asignador buddy.
+ */
+int buddy_init(buddy * b,
+               unsigned int * data,
+               unsigned int * summary,
+               unsigned int start,
+               int count) {
+    int order;
+    int blocks;
+    int entries;
+    int i;
+
+    /* Alinear la base al bloque de mayor orden, para que la alineación de
+     * los bloques coincida con la de las unidades gestionadas */
+    b->base = start & ~(BUDDY_MAX_BLOCK - 1);
+    b->total_slots = count + (start - b->base);
+    b->free_slots = 0;
+
+    for (order = 0; order < BUDDY_ORDERS; order++) {
+        /* Solo se gestionan los bloques completos de este orden */
+        blocks = b->total_slots >> order;
+
+        /* El mapa abarca entradas completas, para que bitmap_allocate
+         * también busque en la última entrada. Los bits que no
+         * corresponden a un bloque completo nunca se liberan. */
+        entries = (blocks + BITS_PER_BITMAP_ENTRY - 1) / BITS_PER_BITMAP_ENTRY;
+
+        bitmap_init(&b->maps[order], data, entries * BITS_PER_BITMAP_ENTRY);
+
+        /* Marcar todos los bloques como ocupados */
+        for (i = 0; i < entries; i++) {
+            data[i] = 0;
+        }
+        b->maps[order].free_slots = 0;
+
+        bitmap_init_summary(&b->maps[order], summary, 0);
+
+        data += entries;
+        summary += b->maps[order].summary_entries;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Reserva un bloque de 2^order unidades.
+ */
+int buddy_alloc(buddy * b, int order) {
+    int k;
+    int index;
+
+    if (order < 0 || order > BUDDY_MAX_ORDER || b->free_slots < (1 << order)) {
+        return -1;
+    }
+
+    /* Buscar el menor orden con un bloque libre */
+    index = -1;
+    for (k = order; k <= BUDDY_MAX_ORDER && index < 0; k++) {
+        index = bitmap_allocate(&b->maps[k]);
+    }
+
+    if (index < 0) {
+        return -1;
+    }
+    k--;
+
+    /* Dividir el bloque, dejando libre la mitad superior en cada orden */
+    while (k > order) {
+        k--;
+        index <<= 1;
+        bitmap_free(&b->maps[k], index + 1);
+    }
+
+    b->free_slots -= (1 << order);
+
+    return b->base + (index << order);
+}
+
+/**
+ * @brief Reserva count unidades contiguas alineadas.
+ */
+int buddy_alloc_region(buddy * b, int count, int align) {
+    int order;
+    int slot;
+
+    if (count <= 0 || align <= 0) {
+        return -1;
+    }
+
+    /* Los bloques de orden k están alineados a 2^k */
+    order = buddy_order(count);
+    if (order < buddy_order(align)) {
+        order = buddy_order(align);
+    }
+
+    slot = buddy_alloc(b, order);
+    if (slot < 0) {
+        return -1;
+    }
+
+    /* Devolver las unidades sobrantes al final del bloque */
+    if (count < (1 << order)) {
+        buddy_free(b, slot + count, (1 << order) - count);
+    }
+
+    return slot;
+}
+
+/**
+ * @brief Libera count unidades contiguas.
+ */
+int buddy_free(buddy * b, unsigned int slot, int count) {
+    unsigned int rel;
+    unsigned int end;
+    int order;
+    int freed;
+
+    if (slot < b->base) {
+        return 0;
+    }
+
+    rel = slot - b->base;
+    end = rel + count;
+    freed = 0;
+
+    if (count <= 0 || end > b->total_slots) {
+        return 0;
+    }
+
+    while (rel < end) {
+        /* Tomar el mayor bloque alineado que cabe en la región restante */
+        order = 0;
+        while (order < BUDDY_MAX_ORDER
+                && (rel & ((2 << order) - 1)) == 0
+                && rel + (2 << order) <= end) {
+            order++;
+        }
+
+        /* No liberar de nuevo las unidades que ya se encuentran libres */
+        freed += buddy_free_aligned(b, rel, order);
+        rel += (1 << order);
+    }
+
+    b->free_slots += freed;
+
+    return freed;
+}
+
+/**
+ * @brief Cuenta las unidades libres dentro de una región.
+ */
+int buddy_available(buddy * b, unsigned int slot, int count) {
+    unsigned int rel;
+    unsigned int end;
+    unsigned int first;
+    unsigned int last;
+    int order;
+    int total;
+
+    if (slot < b->base || count <= 0) {
+        return 0;
+    }
+
+    rel = slot - b->base;
+    end = rel + count;
+    total = 0;
+
+    /* Contar los bloques libres de cada orden que se superponen con la
+     * región, tomando solo la parte que se encuentra dentro de ella. */
+    for (order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        first = rel >> order;
+        last = (end - 1) >> order;
+
+        if (first == last) {
+            if (bitmap_test(&b->maps[order], first)) {
+                total += count;
+            }
+            continue;
+        }
+
+        /* Bloque parcial al inicio de la región */
+        if ((rel & ((1 << order) - 1)) != 0) {
+            if (bitmap_test(&b->maps[order], first)) {
+                total += ((first + 1) << order) - rel;
+            }
+            first++;
+        }
+
+        /* Bloque parcial al final de la región */
+        if ((end & ((1 << order) - 1)) != 0) {
+            if (bitmap_test(&b->maps[order], last)) {
+                total += end - (last << order);
+            }
+            last--;
+        }
+
+        if (last + 1 > first) {
+            total += bitmap_count_free(&b->maps[order], first,
+                    last + 1 - first) << order;
+        }
+    }
+    return total;
+}
@@ -39,6 +39,17 @@ HOWTO de assembler en línea.
 #define bochs_break() \
     inline_assembly("xchg %bx, %bx")
 
+/**
+ * @brief Lee el contador de marcas de tiempo (TSC) del procesador.
+ * @return Número de ciclos transcurridos desde el reinicio del procesador
+ */
+static __inline__ unsigned long long rdtsc(void) {
+	unsigned int low;
+	unsigned int high;
+	inline_assembly("rdtsc" : "=a" (low), "=d" (high));
+	return ((unsigned long long)high << 32) | low;
+}
+
 /**
  * @brief Lee un byte de un puerto de entrada / salida.
  * @param port Puerto de E/S del cual se debe leer el byte
@@ -252,4 +263,111 @@ static __inline__ unsigned int cmpxchgl(unsigned int * lock,
     return ret;
 }
 
+/**
+ * @brief Deshabilita las interrupciones y retorna el valor anterior de
+ * EFLAGS, para restaurarlo con restore_interrupts. Permite proteger
+ * secciones criticas que pueden ser ejecutadas desde un manejador de
+ * interrupcion.
+ * @return Valor de EFLAGS antes de deshabilitar las interrupciones
+ */
+static __inline__ unsigned int disable_interrupts(void) {
+    unsigned int flags;
+
+    inline_assembly("pushfl\n\t" \
+                "popl %0\n\t" \
+                "cli" \
+                : "=r" (flags) \
+                : \
+                : "memory");
+    return flags;
+}
+
+/**
+ * @brief Restaura el valor de EFLAGS almacenado por disable_interrupts. Las
+ * interrupciones solo se habilitan de nuevo si lo estaban antes.
+ * @param flags Valor de EFLAGS retornado por disable_interrupts
+ */
+static __inline__ void restore_interrupts(unsigned int flags) {
+    inline_assembly("pushl %0\n\t" \
+                "popfl" \
+                : \
+                : "r" (flags) \
+                : "memory", "cc");
+}
+
+/** @brief Bit de EFLAGS que indica si el procesador soporta CPUID */
+#define EFLAGS_ID (1 << 21)
+
+/** @brief CPUID.01H:EDX - Extensiones de tamaño de página (páginas de 4 MB) */
+#define CPUID_FEAT_EDX_PSE (1 << 3)
+
+/** @brief CPUID.01H:EDX - Extensión de dirección física */
+#define CPUID_FEAT_EDX_PAE (1 << 6)
+
+/** @brief CPUID.01H:EDX - Páginas globales */
+#define CPUID_FEAT_EDX_PGE (1 << 13)
+
+/** @brief CPUID.01H:EDX - SSE2 (incluye MOVNTI) */
+#define CPUID_FEAT_EDX_SSE2 (1 << 26)
+
+/**
+ * @brief Verifica si el procesador soporta la instrucción CPUID, intentando
+ * modificar el bit ID de EFLAGS.
+ * @return 1 si se soporta CPUID, 0 en caso contrario
+ */
+static __inline__ int cpuid_supported(void) {
+    unsigned int before;
+    unsigned int after;
+
+    inline_assembly("pushfl\n\t" \
+                "popl %0\n\t" \
+                "movl %0, %1\n\t" \
+                "xorl %2, %1\n\t" \
+                "pushl %1\n\t" \
+                "popfl\n\t" \
+                "pushfl\n\t" \
+                "popl %1\n\t" \
+                "pushl %0\n\t" \
+                "popfl" \
+                : "=&r" (before), "=&r" (after) \
+                : "i" (EFLAGS_ID) \
+                : "cc");
+    return ((before ^ after) & EFLAGS_ID) != 0;
+}
+
+/**
+ * @brief Ejecuta la instrucción CPUID.
+ * @param leaf Valor de EAX (función solicitada)
+ * @param eax Apuntador en el cual se almacena EAX
+ * @param ebx Apuntador en el cual se almacena EBX
+ * @param ecx Apuntador en el cual se almacena ECX
+ * @param edx Apuntador en el cual se almacena EDX
+ */
+static __inline__ void cpuid(unsigned int leaf, 
+        unsigned int * eax,
+        unsigned int * ebx,
+        unsigned int * ecx,
+        unsigned int * edx) {
+    inline_assembly("cpuid" \
+                : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx) \
+                : "0" (leaf), "2" (0));
+}
+
+/**
+ * @brief Retorna las características del procesador reportadas en EDX por
+ * CPUID.01H (CPUID_FEAT_EDX_*), o 0 si no se soporta CPUID.
+ */
+static __inline__ unsigned int cpu_features(void) {
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+
+    if (!cpuid_supported()) {
+        return 0;
+    }
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return edx;
+}
+
 #endif /* ASM_H_ */
@@ -11,6 +11,7 @@
 #include <asm.h>
 #include <console.h>
 #include <irq.h>
+#include <memblock.h>
 #include <paging.h>
 #include <pm.h>
 #include <physmem.h>
@@ -22,6 +23,10 @@ void cmain(){
     /* Inicializar y limpiar la consola console.c*/
     setup_console();
 
+    /* Detectar la memoria disponible y habilitar el asignador temprano.
+     * memblock.c */
+    setup_memblock();
+
      /* Inicializar la estructura para gestionar la memoria física. physmem.c*/
     setup_physical_memory();
 
@@ -34,7 +39,16 @@ void cmain(){
     /* Completa la configuración de la memoria virtual. paging.c*/
     setup_paging();
 
+    /* Inicializar los descriptores de marco. physmem.c */
+    setup_frame_descriptors();
+
     /* Las subrutinas que se deben ejecutar DESPUES de habilitar las
      * interrupciones se deben invicar en este punto */
     
+    /* Ciclo de inactividad: llenar de ceros marcos libres para
+     * allocate_zeroed_frame, y esperar la siguiente interrupción. */
+    for (;;) {
+        refill_zeroed_frames();
+        inline_assembly("hlt");
+    }
 }
@@ -0,0 +1,92 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Reserva de memoria de tamaño arbitrario para el kernel. Las
+ * solicitudes pequeñas se atienden con un almacén de memoria (kmemstore)
+ * por cada clase de tamaño, y las grandes con páginas del kernel (kmem).
+ */
+
+#ifndef KMALLOC_H_
+#define KMALLOC_H_
+
+#include <kmem.h>
+#include <kmemstore.h>
+
+/** @brief Tamaño del bloque de la menor clase de tamaño */
+#define KMALLOC_MIN_SIZE 16
+
+/** @brief Tamaño del bloque de la mayor clase de tamaño. Las solicitudes
+ * que no caben en un bloque de este tamaño se atienden con páginas. */
+#define KMALLOC_MAX_SIZE 2048
+
+/** @brief Número de clases de tamaño: potencias de 2 de 16 B a 2 KB, y los
+ * tamaños intermedios (1,5 veces la potencia anterior) a partir de 48 B */
+#define KMALLOC_CLASSES 14
+
+/** @brief Valor del campo class del encabezado para los bloques reservados
+ * con páginas del kernel */
+#define KMALLOC_PAGES 0xFFFFFFFF
+
+/** @brief Encabezado que precede a cada bloque entregado por kmalloc.
+ * Ocupa 8 bytes, por lo cual los bloques quedan alineados a 8 bytes. */
+typedef struct {
+    /** @brief Tamaño solicitado en bytes */
+    unsigned int size;
+    /** @brief Clase de tamaño del bloque, o KMALLOC_PAGES */
+    unsigned int class;
+}kmalloc_header;
+
+/** @brief Estadísticas de uso de kmalloc. La diferencia entre reserved y
+ * requested es la fragmentación interna de los bloques en uso. */
+typedef struct {
+    /** @brief Número de reservas exitosas */
+    unsigned int allocs;
+    /** @brief Número de bloques liberados */
+    unsigned int frees;
+    /** @brief Bytes solicitados por los bloques en uso */
+    unsigned int requested;
+    /** @brief Bytes que ocupan los bloques en uso, incluidos los
+     * encabezados */
+    unsigned int reserved;
+}kmalloc_stats;
+
+/** @brief Estadísticas de uso de kmalloc */
+extern kmalloc_stats kmalloc_usage;
+
+/**
+ * @brief Reserva un bloque de memoria del kernel. El almacén de cada clase
+ * de tamaño se crea la primera vez que se usa.
+ * @param size Tamaño en bytes
+ * @return Dirección del bloque, alineada a 8 bytes, 0 si size es 0 o no
+ * existe memoria disponible
+ */
+void * kmalloc(unsigned int size);
+
+/**
+ * @brief Libera un bloque reservado con kmalloc o krealloc.
+ * @param ptr Dirección del bloque. Si es 0 no se realiza ninguna acción.
+ */
+void kfree(void * ptr);
+
+/**
+ * @brief Cambia el tamaño de un bloque reservado con kmalloc. Si el nuevo
+ * tamaño cabe en el bloque actual se conserva la misma dirección; en caso
+ * contrario se reserva un nuevo bloque, se copia el contenido y se libera
+ * el bloque anterior.
+ * @param ptr Dirección del bloque, o 0 para reservar un nuevo bloque
+ * @param size Nuevo tamaño en bytes. Si es 0 se libera el bloque.
+ * @return Dirección del bloque, 0 si no se pudo reservar (el bloque
+ * anterior se conserva) o si size es 0
+ */
+void * krealloc(void * ptr, unsigned int size);
+
+/**
+ * @brief Retorna la capacidad de un bloque reservado con kmalloc.
+ * @param ptr Dirección del bloque
+ * @return Número de bytes que se pueden usar en el bloque
+ */
+unsigned int ksize(void * ptr);
+
+#endif /* KMALLOC_H_ */
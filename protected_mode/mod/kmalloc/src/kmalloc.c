@@ -0,0 +1,209 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementación de kmalloc, kfree y krealloc. Cada
+ * bloque se precede de un encabezado que indica su clase de tamaño, de
+ * forma que kfree no debe buscar el almacén al cual pertenece.
+ */
+
+#include <kmalloc.h>
+#include <string.h>
+
+/** @brief Tamaño de bloque de cada clase, en orden creciente */
+static const unsigned int kmalloc_sizes[KMALLOC_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
+/** @brief Almacén de memoria de cada clase de tamaño, 0 si aún no se ha
+ * creado */
+static kmemstore * kmalloc_stores[KMALLOC_CLASSES];
+
+/** @brief Clase de tamaño de cada múltiplo de KMALLOC_MIN_SIZE: la clase
+ * de un bloque de n bytes es kmalloc_index[(n - 1) / KMALLOC_MIN_SIZE] */
+static unsigned char kmalloc_index[KMALLOC_MAX_SIZE / KMALLOC_MIN_SIZE];
+
+/** @brief 1 si ya se construyó kmalloc_index */
+static int kmalloc_index_ready = 0;
+
+/** @brief Estadísticas de uso de kmalloc */
+kmalloc_stats kmalloc_usage;
+
+/**
+ * @brief Obtiene la clase de tamaño del menor bloque que contiene n bytes.
+ * @param n Tamaño del bloque, incluido el encabezado (máximo
+ * KMALLOC_MAX_SIZE)
+ * @return Clase de tamaño
+ */
+static int kmalloc_class(unsigned int n) {
+    int i;
+    int class;
+
+    if (!kmalloc_index_ready) {
+        class = 0;
+        for (i = 0; i < KMALLOC_MAX_SIZE / KMALLOC_MIN_SIZE; i++) {
+            if ((i + 1) * KMALLOC_MIN_SIZE > kmalloc_sizes[class]) {
+                class++;
+            }
+            kmalloc_index[i] = class;
+        }
+        kmalloc_index_ready = 1;
+    }
+
+    return kmalloc_index[(n - 1) / KMALLOC_MIN_SIZE];
+}
+
+/**
+ * @brief Obtiene el número de páginas de un bloque reservado con páginas.
+ * @param size Tamaño solicitado en bytes
+ * @return Número de páginas, incluido el encabezado
+ */
+static unsigned int kmalloc_pages(unsigned int size) {
+    return (size + sizeof(kmalloc_header) + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+/**
+ * @brief Reserva un bloque de memoria del kernel.
+ */
+void * kmalloc(unsigned int size) {
+    kmalloc_header * h;
+    unsigned int n;
+    unsigned int pages;
+    int class;
+
+    if (size == 0 || size > KMEM_MAXSIZE - sizeof(kmalloc_header)) {
+        return 0;
+    }
+
+    n = size + sizeof(kmalloc_header);
+
+    if (n <= KMALLOC_MAX_SIZE) {
+        class = kmalloc_class(n);
+        if (kmalloc_stores[class] == 0) {
+            kmalloc_stores[class] = new_memstore(kmalloc_sizes[class]);
+            if (kmalloc_stores[class] == 0) {
+                return 0;
+            }
+        }
+        h = (kmalloc_header *)memstore_alloc(kmalloc_stores[class]);
+        if (h == 0) {
+            return 0;
+        }
+        h->class = class;
+        kmalloc_usage.reserved += kmalloc_sizes[class];
+    }else {
+        /* Se prefieren marcos contiguos, que se mapean con una sola
+         * operación (o ya se encuentran en el mapa directo) */
+        pages = kmalloc_pages(size);
+        h = (kmalloc_header *)kmem_allocate_pages(pages, KMEM_CONTIGUOUS);
+        if (h == 0) {
+            h = (kmalloc_header *)kmem_allocate_pages(pages, KMEM_SPARSE);
+        }
+        if (h == 0) {
+            return 0;
+        }
+        h->class = KMALLOC_PAGES;
+        kmalloc_usage.reserved += pages * PAGE_SIZE;
+    }
+
+    h->size = size;
+    kmalloc_usage.allocs++;
+    kmalloc_usage.requested += size;
+
+    return (void *)(h + 1);
+}
+
+/**
+ * @brief Libera un bloque reservado con kmalloc o krealloc.
+ */
+void kfree(void * ptr) {
+    kmalloc_header * h;
+    unsigned int pages;
+
+    if (ptr == 0) {
+        return;
+    }
+
+    h = (kmalloc_header *)ptr - 1;
+
+    kmalloc_usage.frees++;
+    kmalloc_usage.requested -= h->size;
+
+    if (h->class == KMALLOC_PAGES) {
+        pages = kmalloc_pages(h->size);
+        kmalloc_usage.reserved -= pages * PAGE_SIZE;
+        kmem_free_pages((unsigned int)h, pages);
+        return;
+    }
+
+    if (h->class < KMALLOC_CLASSES && kmalloc_stores[h->class] != 0) {
+        kmalloc_usage.reserved -= kmalloc_sizes[h->class];
+        memstore_free(kmalloc_stores[h->class], h);
+    }
+}
+
+/**
+ * @brief Retorna la capacidad de un bloque reservado con kmalloc.
+ */
+unsigned int ksize(void * ptr) {
+    kmalloc_header * h;
+
+    if (ptr == 0) {
+        return 0;
+    }
+
+    h = (kmalloc_header *)ptr - 1;
+
+    if (h->class == KMALLOC_PAGES) {
+        return kmalloc_pages(h->size) * PAGE_SIZE - sizeof(kmalloc_header);
+    }
+    return kmalloc_sizes[h->class] - sizeof(kmalloc_header);
+}
+
+/**
+ * @brief Cambia el tamaño de un bloque reservado con kmalloc.
+ */
+void * krealloc(void * ptr, unsigned int size) {
+    kmalloc_header * h;
+    void * new_ptr;
+    unsigned int pages;
+
+    if (ptr == 0) {
+        return kmalloc(size);
+    }
+
+    if (size == 0) {
+        kfree(ptr);
+        return 0;
+    }
+
+    h = (kmalloc_header *)ptr - 1;
+
+    /* El nuevo tamaño cabe en el bloque actual */
+    if (size <= ksize(ptr)) {
+        /* El número de páginas de un bloque se calcula a partir de su
+         * tamaño: liberar las páginas sobrantes al final del bloque */
+        pages = kmalloc_pages(size);
+        if (h->class == KMALLOC_PAGES && pages < kmalloc_pages(h->size)) {
+            kmem_free_pages((unsigned int)h + pages * PAGE_SIZE,
+                    kmalloc_pages(h->size) - pages);
+            kmalloc_usage.reserved -= 
+                (kmalloc_pages(h->size) - pages) * PAGE_SIZE;
+        }
+        kmalloc_usage.requested += size;
+        kmalloc_usage.requested -= h->size;
+        h->size = size;
+        return ptr;
+    }
+
+    new_ptr = kmalloc(size);
+    if (new_ptr == 0) {
+        return 0;
+    }
+
+    memcpy(new_ptr, ptr, (size < h->size) ? size : h->size);
+    kfree(ptr);
+
+    return new_ptr;
+}
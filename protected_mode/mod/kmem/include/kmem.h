@@ -37,6 +37,24 @@
 /** @brief Paginas contiguas */
 #define KMEM_CONTIGUOUS 1 
 
+/** @brief Máximo número de regiones reservadas con kmem_reserve */
+#define KMEM_MAX_RESERVED 32
+
+/** @brief Las páginas de una región reservada se llenan de ceros al
+ * accederlas por primera vez */
+#define KMEM_ZEROED 1
+
+/** @brief Región de memoria virtual cuyas páginas se mapean al accederlas
+ * por primera vez */
+typedef struct {
+    /** @brief Dirección de inicio, 0 si la entrada no se usa */
+    unsigned int start;
+    /** @brief Número de páginas */
+    unsigned int pages;
+    /** @brief Opciones de la región (KMEM_ZEROED) */
+    int flags;
+}kmem_reserved_region;
+
 /** @brief Numero total de paginas disponibles */
 extern int kmem_available_pages;
 
@@ -71,6 +89,57 @@ unsigned int kmem_allocate_page(void);
  */
 unsigned int kmem_allocate_pages(int count, int sparse);
 
+/**
+ * @brief Busca y mapea una región continua de páginas libres, cuya
+ * dirección de inicio es múltiplo de align páginas. Permite ubicar al
+ * inicio de la región datos que se localizan enmascarando cualquier
+ * dirección de la región.
+ * @param count Numero de paginas a buscar y mapear
+ * @param align Alineación en páginas (potencia de 2)
+ * @param sparse KMEM_SPARSE | KMEM_CONTIGUOUS
+ * @return Dirección de inicio de la región, 0 si no existe
+ */
+unsigned int kmem_allocate_pages_aligned(int count, int align, int sparse);
+
+/**
+ * @brief Reserva y mapea una región de memoria alineada a PT_COVERAGE
+ * (4 MB, o 2 MB en modo PAE). Cada bloque de PT_COVERAGE bytes se mapea con
+ * una página grande si existe una región física contigua y alineada, o con
+ * páginas de 4 KB en caso contrario. La región no puede ser mayor a
+ * KMEM_GRANULARITY.
+ * @param size Tamaño de la región en bytes, se redondea a un múltiplo de
+ * PT_COVERAGE
+ * @return Dirección de inicio de la región, 0 si no existe
+ */
+unsigned int kmem_allocate_large(unsigned int size);
+
+/**
+ * @brief Libera una región reservada con kmem_allocate_large
+ * @param addr Dirección de inicio de la región
+ * @param size Tamaño de la región en bytes
+ * @return 1 si exitoso, 0 si error.
+ */
+int kmem_free_large(unsigned int addr, unsigned int size);
+
+/**
+ * @brief Reserva una región de memoria virtual sin mapearla. Cada página se
+ * mapea a un marco en el manejador de fallo de página cuando se accede por
+ * primera vez, por lo cual solo las partes usadas de la región ocupan
+ * memoria física.
+ * @param size Tamaño de la región en bytes (máximo KMEM_GRANULARITY)
+ * @param flags 0 | KMEM_ZEROED
+ * @return Dirección de inicio de la región, 0 si no existe
+ */
+unsigned int kmem_reserve(unsigned int size, int flags);
+
+/**
+ * @brief Libera una región reservada con kmem_reserve, junto con los marcos
+ * de las páginas que se accedieron.
+ * @param addr Dirección de inicio de la región
+ * @return 1 si exitoso, 0 si la región no existe.
+ */
+int kmem_release(unsigned int addr);
+
 /**
  * @brief Permite liberar una página
  * @param addr Dirección de la página a liberar
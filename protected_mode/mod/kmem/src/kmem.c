@@ -9,11 +9,6 @@
 #include <stdlib.h>
 #include <kmem.h>
 
-/** @brief Mapa de bits de la memoria lineal del kernel. */
-unsigned int 
-    kernel_memory_bitmap[KMEM_MAXPAGES / BITS_PER_BITMAP_ENTRY] 
-    __attribute__((aligned(4096)));
-
 /** @brief Lista de regiones de memoria virtual */
 memory_region kmem[KMEM_REGION_COUNT];
 
@@ -33,11 +28,80 @@ int kmem_available_pages;
  * terminan las tablas de página iniciales del kernel */
 extern unsigned int kernel_initial_pagetables_end;
 
+/* Variable definida en start.S que almacena el número de páginas de 4 MB
+ * con las cuales se mapea el kernel (0 si se usan tablas de página) */
+extern unsigned int kernel_large_pages;
+
+/** @brief Regiones reservadas con kmem_reserve */
+kmem_reserved_region kmem_reserved[KMEM_MAX_RESERVED];
+
 /** @brief Mapa de bits de memoria virtual del kernel
  * @details Esta variable almacena el apuntador del inicio del mapa de bits
  * que permite gestionar las unidades de memoria. */
  unsigned int * kmem_bitmap;
 
+/**
+ * @brief Busca la región reservada que contiene una dirección
+ * @param addr Dirección virtual
+ * @return Región que contiene la dirección, 0 si no existe
+ */
+static kmem_reserved_region * kmem_find_reserved(unsigned int addr) {
+    int i;
+
+    for (i = 0; i < KMEM_MAX_RESERVED; i++) {
+        if (kmem_reserved[i].start != 0 &&
+                addr >= kmem_reserved[i].start &&
+                (addr - kmem_reserved[i].start) / PAGE_SIZE 
+                    < kmem_reserved[i].pages) {
+            return &kmem_reserved[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Resuelve un fallo de página en una región reservada, mapeando un
+ * marco en la página.
+ * @param vaddr Dirección que causó el fallo
+ * @param error Código de error del fallo
+ * @return 1 si se mapeó la página, 0 en caso contrario
+ */
+static int kmem_resolve_fault(unsigned int vaddr, unsigned int error) {
+    kmem_reserved_region * region;
+    unsigned int frame;
+
+    //Solo se resuelven los accesos a paginas no presentes
+    if (error & PF_PRESENT) {
+        return 0;
+    }
+
+    region = kmem_find_reserved(vaddr);
+    if (region == 0) {
+        return 0;
+    }
+
+    if (region->flags & KMEM_ZEROED) {
+        //Las lecturas usan el marco de ceros compartido, que se reemplaza
+        //en la primera escritura (paging.c)
+        if (!(error & PF_WRITE) && map_zero_page(vaddr)) {
+            return 1;
+        }
+        frame = allocate_zeroed_frame();
+    }else {
+        frame = allocate_frame();
+    }
+
+    if (!frame) {
+        return 0;
+    }
+
+    if (!map_page(vaddr, frame)) {
+        free_frame(frame);
+        return 0;
+    }
+    return 1;
+}
+
 /**
  * @brief Inicializa la memoria virtual del kernel
  */
@@ -48,11 +112,13 @@ void setup_kmem(void){
     unsigned int tmp_start;
     unsigned int tmp_end;
 
-    /* Apuntar al mapa de bits de la memoria del kernel. */
-    kmem_bitmap = (unsigned int*)&kernel_memory_bitmap;
-
     unsigned int * tmp_ptr;
+    unsigned int * tmp_summary;
     int slots;
+    int regions;
+    unsigned int entries;
+    unsigned int pages;
+    unsigned int frame;
 
     /* Inicializar las regiones de memoria disponibles */
     kmem_count = 0;
@@ -60,15 +126,57 @@ void setup_kmem(void){
 
     //Inicio de la memoria virtual disponible
     //Donde terminan las tablas de pagina  iniciales + 1 pagina
-    tmp_start = kernel_initial_pagetables_end + PAGE_SIZE + KERNEL_VIRT_OFFSET; 
+    tmp_start = kernel_initial_pagetables_end + PAGE_SIZE;
+
+    //Si el kernel se mapeó con páginas de 4 MB, la última página grande
+    //ocupa la memoria virtual hasta el siguiente límite de 4 MB
+    if (tmp_start < kernel_large_pages * PSE_PAGE_SIZE) {
+        tmp_start = kernel_large_pages * PSE_PAGE_SIZE;
+    }
+
+    //La memoria virtual disponible comienza despues del mapa directo
+    if (tmp_start < physmap_end) {
+        tmp_start = (physmap_end + PT_COVERAGE - 1) & ~(PT_COVERAGE - 1);
+    }
+    tmp_start += KERNEL_VIRT_OFFSET;
 
     /*console_printf("Available virtual memory starts at 0x%x\n", tmp_start);*/
 
     //Fin de la memoria virtual disponible
     tmp_end = KMEM_LIMIT - KMEM_RESERVED;
 
+    if (tmp_start >= tmp_end) {
+        return;
+    }
+
+    //Mapa de bits y resumenes, de acuerdo con el tamaño de la memoria
+    //virtual disponible. Se almacenan en las primeras paginas de ella.
+    regions = (tmp_end - tmp_start) / KMEM_GRANULARITY + 1;
+    entries = (tmp_end - tmp_start) / PAGE_SIZE / BITS_PER_BITMAP_ENTRY
+        + regions;
+    pages = ((entries + regions 
+                * BITMAP_SUMMARY_ENTRIES(KMEM_GRANULARITY / PAGE_SIZE))
+            * sizeof(unsigned int) + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    for (i = 0; i < pages; i++) {
+        frame = allocate_frame();
+        if (frame == 0) {
+            return;
+        }
+        if (!map_page(tmp_start + i * PAGE_SIZE, frame)) {
+            free_frame(frame);
+            return;
+        }
+    }
+
     //Mapa de bits
-    tmp_ptr = (unsigned int*)&kernel_memory_bitmap; 
+    tmp_ptr = (unsigned int*)tmp_start; 
+    kmem_bitmap = tmp_ptr;
+
+    //Resumen de los mapas de bits
+    tmp_summary = tmp_ptr + entries;
+
+    tmp_start += pages * PAGE_SIZE;
 
     do {
         if (tmp_start < tmp_end) {
@@ -92,6 +200,10 @@ void setup_kmem(void){
             /* Inicializar el mapa de bits para esta region */
             bitmap_init(&kmem[kmem_count].map, tmp_ptr, slots);
 
+            /* Adicionar el resumen, para no recorrer entradas llenas */
+            bitmap_init_summary(&kmem[kmem_count].map, tmp_summary, 0);
+            tmp_summary += kmem[kmem_count].map.summary_entries;
+
             /* Apuntar a la siguiente entrada */
             tmp_ptr += slots / BITS_PER_BITMAP_ENTRY;
 
@@ -112,6 +224,13 @@ void setup_kmem(void){
         tmp_start += KMEM_GRANULARITY;
     }while (tmp_start < tmp_end);
 
+    for (i = 0; i < KMEM_MAX_RESERVED; i++) {
+        kmem_reserved[i].start = 0;
+    }
+
+    //Mapear bajo demanda las paginas de las regiones reservadas
+    install_page_fault_resolver(kmem_resolve_fault);
+
     if (kmem_count > 0) {
         kmem[kmem_count - 1].next = &kmem[0];
         kmem[0].prev = &kmem[kmem_count - 1];
@@ -188,35 +307,107 @@ unsigned int kmem_get_pages(int count) {
     return 0;
 }
 
+/**
+ * @brief Busca una región continua de páginas libres, cuya dirección de
+ * inicio es múltiplo de align páginas
+ * @return Dirección de inicio de la región, 0 si no existe
+ */
+static unsigned int kmem_get_pages_aligned(int count, int align) {
+    unsigned int addr;
+    int slot;
+    memory_region * aux;
+
+    if (kmem_available_pages < count) {
+        return 0;
+    }
+
+    aux = current_kmem;
+
+    do {
+        if (aux->map.free_slots >= count) {
+            slot = bitmap_allocate_aligned(&aux->map, count, align,
+                    aux->start / PAGE_SIZE);
+            if (slot >= 0) {
+                addr = aux->start + (slot * PAGE_SIZE);
+                kmem_available_pages -= count;
+                return addr;
+            }
+        }
+        aux = aux->next;
+    }while(aux != current_kmem);
+
+    return 0;
+}
+
+/**
+ * @brief Reserva un marco libre y lo mapea en una página. Si no existen
+ * marcos por debajo de 4 GB, en modo PAE se usa un marco de memoria alta.
+ * @param page Dirección de la página
+ * @return 1 si exitoso, 0 si error
+ */
+static int kmem_map_new_frame(unsigned int page) {
+    unsigned int frame;
+
+    frame = allocate_frame();
+    /*console_printf("Frame at: 0x%x\n", frame);*/
+    if (frame) {
+        if (map_page(page, frame)) {
+            return 1;
+        }
+        //No se pudo mapear la pagina, liberar el marco
+        free_frame(frame);
+        return 0;
+    }
+
+    frame = allocate_high_frame();
+    if (frame) {
+        if (map_page_frame(page, frame)) {
+            return 1;
+        }
+        free_frame_number(frame);
+    }
+    return 0;
+}
+
 /**
  * @brief Busca una página y un marco libre y realiza el mapeo
  * @return Dirección de inicio de la página
  */
 unsigned int kmem_allocate_page(void){
-    unsigned int frame;
     unsigned int page;
+    unsigned int frame;
 
-    frame = allocate_frame();
-    /*console_printf("Frame at: 0x%x\n", frame);*/
-    if (!frame) {
+    if (available_frames() == 0 && available_high_frames() == 0) {
         return 0;
     }
 
+    //Los marcos del mapa directo no requieren actualizar las tablas de
+    //pagina
+    frame = allocate_frame();
+    if (frame && physmap_contains(frame)) {
+        return phys_to_virt(frame);
+    }
+
     page = kmem_get_page();
     /*console_printf("Page at: 0x%x\n", page);*/
 
     if (!page) {
-        free_frame(frame);
+        if (frame) {
+            free_frame(frame);
+        }
         return 0;
     }
 
-    if (map_page(page, frame)) {
-        return page;
-    }else {
-        kmem_free(page);
-        //No se pudo mapear la pagina, liberar el marco
+    if (frame) {
+        if (map_page(page, frame)) {
+            return page;
+        }
         free_frame(frame);
+    }else if (kmem_map_new_frame(page)) {
+        return page;
     }
+
+    kmem_free(page);
     return 0;
 }
 
@@ -227,29 +418,61 @@ unsigned int kmem_allocate_page(void){
  * @return Dirección de inicio de la página
  */
 unsigned int kmem_allocate_pages(int count, int sparse) {
+    return kmem_allocate_pages_aligned(count, 1, sparse);
+}
+
+/**
+ * @brief Busca y mapea una región continua de páginas libres, cuya
+ * dirección de inicio es múltiplo de align páginas
+ */
+unsigned int kmem_allocate_pages_aligned(int count, int align, int sparse) {
     int i;
     unsigned int page;
     int done;
 
 
-    unsigned int tmp_frame;
     unsigned int tmp_page;
-    int j;
     unsigned int frame;
 
     //Retornar inmediatamente si se solicita una sola pagina
-    if (count == 1) {
+    if (count == 1 && align <= 1) {
         return kmem_allocate_page();
     }
 
     //Verificar si existen suficientes marcos de pagina disponibles
-    if (available_frames() < count) {
+    if (available_frames() + available_high_frames() < count) {
         return 0;
     }
 
+    if (sparse == KMEM_CONTIGUOUS) {
+        //Buscar count marcos de pagina adyacentes
+        if (align > 1) {
+            frame = allocate_frame_region_aligned(count * FRAME_SIZE,
+                    align * FRAME_SIZE);
+        }else {
+            frame = allocate_frame_region(count * FRAME_SIZE);
+        }
+        if (!frame) {
+            return 0;
+        }
+        //Si la region se encuentra en el mapa directo, no se requiere mapear
+        //las paginas. KERNEL_VIRT_OFFSET es multiplo de cualquier alineacion
+        //menor a 1 GB, por lo cual la pagina conserva la del marco.
+        if (physmap_contains(frame + (count - 1) * FRAME_SIZE)) {
+            return phys_to_virt(frame);
+        }
+    }
+
     //Obtener las paginas contiguas en memoria virtual
-    page = kmem_get_pages(count);
+    if (align > 1) {
+        page = kmem_get_pages_aligned(count, align);
+    }else {
+        page = kmem_get_pages(count);
+    }
     if (!page) {
+        if (sparse == KMEM_CONTIGUOUS) {
+            free_frame_region(frame, count * FRAME_SIZE);
+        }
         return 0;
     }
 
@@ -261,40 +484,117 @@ unsigned int kmem_allocate_pages(int count, int sparse) {
         for (i = 0 ;
                 i < count && done == 1; 
                 i++, tmp_page += PAGE_SIZE){
-            tmp_frame = allocate_frame();
-            if (!map_page(tmp_page, tmp_frame)) {
+            if (!kmem_map_new_frame(tmp_page)) {
                 done = 0;
             }
         }
 
     }else {
-        //Buscar count marcos de pagina adyacentes
-        frame = allocate_frame_region(count * FRAME_SIZE);
-        if (frame) {
-            tmp_frame = frame;
-            done = 1;
-            for (i = 0; 
-                    i < count && done == 1; 
-                    i++, tmp_page += PAGE_SIZE, tmp_frame += FRAME_SIZE){
-                if (!map_page(tmp_page, tmp_frame)) {
-                    done = 0;
-                }
-            }
-        }else {
-            done = 0;
+        //Mapear las paginas a los marcos adyacentes
+        if (!map_range(page, frame, count, PG_KERNEL_PRESENT)) {
+            //Liberar las paginas y los marcos
+            kmem_free_pages(page, count);
+            free_frame_region(frame, count * FRAME_SIZE);
+            return 0;
         }
     }
     if (done) {
         return page;
     }else {
-        for (j = 0; j <i; j++, page += PAGE_SIZE) {
-            kmem_free(page);
-        }
+        //Liberar todas las paginas reservadas, y los marcos de las que
+        //alcanzaron a mapearse
+        kmem_free_pages(page, count);
     }
     return 0;
 }
 
 
+/**
+ * @brief Mapea un bloque de PT_COVERAGE bytes de memoria virtual. Se usa una
+ * página grande si es posible, y páginas de 4 KB en caso contrario.
+ * @param vaddr Dirección del bloque, alineada a PT_COVERAGE
+ * @return 1 si exitoso, 0 si error
+ */
+static int kmem_map_large(unsigned int vaddr) {
+    unsigned int frame;
+    unsigned int page;
+
+    if (large_pages_supported()) {
+        frame = allocate_frame_region_aligned(PT_COVERAGE, PT_COVERAGE);
+        if (frame) {
+            if (map_large_page(vaddr, frame)) {
+                return 1;
+            }
+            //La entrada del directorio ya tiene una tabla de paginas
+            free_frame_region(frame, PT_COVERAGE);
+        }
+    }
+
+    for (page = vaddr; page < vaddr + PT_COVERAGE; page += PAGE_SIZE) {
+        if (!kmem_map_new_frame(page)) {
+            //Deshacer el mapeo de las paginas anteriores
+            if (page > vaddr) {
+                destroy_range(vaddr, (page - vaddr) / PAGE_SIZE);
+            }
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Reserva y mapea una región de memoria alineada a PT_COVERAGE
+ */
+unsigned int kmem_allocate_large(unsigned int size) {
+    unsigned int start;
+    unsigned int vaddr;
+    int blocks;
+
+    if (size == 0 || size > KMEM_GRANULARITY) {
+        return 0;
+    }
+
+    blocks = (size + PT_COVERAGE - 1) / PT_COVERAGE;
+
+    //Obtener las paginas contiguas y alineadas en memoria virtual
+    start = kmem_get_pages_aligned(blocks * PT_ENTRIES, PT_ENTRIES);
+    if (!start) {
+        return 0;
+    }
+
+    for (vaddr = start; blocks > 0; blocks--, vaddr += PT_COVERAGE) {
+        if (!kmem_map_large(vaddr)) {
+            //Liberar los bloques ya mapeados y las paginas restantes
+            kmem_free_large(start, vaddr - start);
+            kmem_free_pages(vaddr, blocks * PT_ENTRIES);
+            return 0;
+        }
+    }
+
+    return start;
+}
+
+/**
+ * @brief Busca la region que contiene una direccion virtual. Las regiones
+ * son consecutivas y de KMEM_GRANULARITY bytes a partir de la primera, por
+ * lo cual la posicion se calcula directamente.
+ * @param addr Direccion virtual
+ * @return Region que contiene la direccion, 0 si no existe
+ */
+static memory_region * kmem_find_region(unsigned int addr) {
+    unsigned int index;
+
+    if (kmem_count == 0 || addr < kmem[0].start) {
+        return 0;
+    }
+
+    index = (addr - kmem[0].start) / KMEM_GRANULARITY;
+    if (index >= kmem_count) {
+        return 0;
+    }
+    return &kmem[index];
+}
+
 /**
  * @brief Permite liberar una página
  * @param addr Dirección de la página a liberar
@@ -306,21 +606,26 @@ int kmem_free(unsigned int addr) {
     memory_region * aux;
 
     start = ROUND_DOWN_TO_PAGE(addr);
-    aux = current_kmem;
 
-    do {
-        if (start >= aux->start && start < aux->start + aux->length) {
-            slot = (start - aux->start) / PAGE_SIZE;
-            if (bitmap_free(&aux->map, slot)) {
-                //Liberar la pagina y el marco de pagina
-                kmem_available_pages++;
-                destroy_page(addr);
-            }
-            return 1;
-        }
-        aux = aux->next;
-    }while(aux != current_kmem);
-    return 0;
+    //Las paginas del mapa directo solo requieren liberar el marco
+    if (start >= PHYSMAP_VADDR && physmap_contains(virt_to_phys(start))) {
+        free_frame(virt_to_phys(start));
+        return 1;
+    }
+
+    aux = kmem_find_region(start);
+
+    if (aux == 0 || start >= aux->start + aux->length) {
+        return 0;
+    }
+
+    slot = (start - aux->start) / PAGE_SIZE;
+    if (bitmap_free(&aux->map, slot)) {
+        //Liberar la pagina y el marco de pagina
+        kmem_available_pages++;
+        destroy_page(addr);
+    }
+    return 1;
 }
 
 /**
@@ -329,9 +634,26 @@ int kmem_free(unsigned int addr) {
 int kmem_free_pages(unsigned int start, unsigned int count) {
 
     unsigned int addr = ROUND_DOWN_TO_PAGE(start);
+    unsigned int slot;
+    unsigned int i;
+    memory_region * aux;
 
     int ret = 1;
 
+    //Si todas las paginas pertenecen a la misma region, liberarlas y
+    //quitar su mapeo con una sola operacion sobre las tablas de pagina
+    aux = kmem_find_region(addr);
+    if (aux != 0 && count > 0 &&
+            addr + (count * PAGE_SIZE) <= aux->start + aux->length) {
+        slot = (addr - aux->start) / PAGE_SIZE;
+        for (i = 0; i < count; i++) {
+            if (bitmap_free(&aux->map, slot + i)) {
+                kmem_available_pages++;
+            }
+        }
+        return destroy_range(addr, count);
+    }
+
     while (count > 0) {
         ret = ret & kmem_free(addr);
         addr += PAGE_SIZE;
@@ -340,6 +662,95 @@ int kmem_free_pages(unsigned int start, unsigned int count) {
     return ret;
 }
 
+/**
+ * @brief Libera una región reservada con kmem_allocate_large
+ */
+int kmem_free_large(unsigned int addr, unsigned int size) {
+    unsigned int vaddr;
+    unsigned int end;
+    unsigned int frame;
+    memory_region * aux;
+    int ret;
+
+    ret = 1;
+    end = addr + size;
+
+    for (vaddr = addr; vaddr < end; vaddr += PT_COVERAGE) {
+        frame = unmap_large_page(vaddr);
+        if (!frame) {
+            //El bloque se mapeo con paginas de 4 KB
+            ret = ret & kmem_free_pages(vaddr, PT_ENTRIES);
+            continue;
+        }
+
+        free_frame_region(frame, PT_COVERAGE);
+
+        aux = kmem_find_region(vaddr);
+        if (aux == 0) {
+            ret = 0;
+            continue;
+        }
+        bitmap_free_region(&aux->map, (vaddr - aux->start) / PAGE_SIZE,
+                PT_ENTRIES);
+        kmem_available_pages += PT_ENTRIES;
+    }
+    return ret;
+}
+
+/**
+ * @brief Reserva una región de memoria virtual sin mapearla.
+ */
+unsigned int kmem_reserve(unsigned int size, int flags) {
+    unsigned int start;
+    unsigned int pages;
+    int i;
+
+    if (size == 0 || size > KMEM_GRANULARITY) {
+        return 0;
+    }
+
+    pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    //Buscar una entrada libre en la tabla de regiones reservadas
+    i = 0;
+    while (i < KMEM_MAX_RESERVED && kmem_reserved[i].start != 0) {
+        i++;
+    }
+    if (i == KMEM_MAX_RESERVED) {
+        return 0;
+    }
+
+    start = kmem_get_pages(pages);
+    if (!start) {
+        return 0;
+    }
+
+    kmem_reserved[i].pages = pages;
+    kmem_reserved[i].flags = flags;
+    kmem_reserved[i].start = start;
+
+    return start;
+}
+
+/**
+ * @brief Libera una región reservada con kmem_reserve.
+ */
+int kmem_release(unsigned int addr) {
+    kmem_reserved_region * region;
+    unsigned int pages;
+
+    region = kmem_find_reserved(addr);
+    if (region == 0 || region->start != addr) {
+        return 0;
+    }
+
+    pages = region->pages;
+    region->start = 0;
+
+    //Liberar las paginas virtuales, y los marcos de las paginas mapeadas
+    return kmem_free_pages(addr, pages);
+}
+
 /**
  * @brief Retorna el número de páginas disponibles en la memoria del kernel
  * @return Número de páginas disponibles
@@ -13,13 +13,64 @@
 #include <kmem.h>
 #include <kpool.h>
 
+/** @brief Mínimo número de bloques de cada almacen de bloques. Si en una
+ * página no caben estos bloques, el almacen ocupa más páginas (hasta
+ * KMEMSTORE_MAX_PAGES). */
+#define KMEMSTORE_MIN_BLOCKS 4
+
+/** @brief Máximo número de páginas de un almacen de bloques, salvo que
+ * se requieran más para un solo bloque. */
+#define KMEMSTORE_MAX_PAGES 8
+
+/** @brief Cantidad de procesadores con magazines propios. El kernel se
+ * ejecuta en un solo procesador. */
+#define KMEMSTORE_CPUS 1
+
+/** @brief Cantidad de bloques que almacena un magazine. Con este valor un
+ * magazine ocupa 64 bytes. */
+#define KMEMSTORE_MAGAZINE_SIZE 14
+
+/** @brief Magazine: pila de bloques libres de un almacen de memoria */
+typedef struct kmagazine {
+  unsigned int rounds; // Cantidad de bloques en el magazine
+  struct kmagazine * next; // Siguiente magazine del deposito
+  void * blocks[KMEMSTORE_MAGAZINE_SIZE]; // Bloques libres
+} kmagazine;
+
+/** @brief Magazines y contadores de un procesador */
+typedef struct {
+  kmagazine * loaded; // Magazine del cual se toman y al cual se devuelven bloques
+  kmagazine * previous; // Magazine cargado anteriormente
+  unsigned int alloc_hits; // Reservas atendidas por los magazines
+  unsigned int alloc_misses; // Reservas atendidas por el deposito o los almacenes de bloques
+  unsigned int free_hits; // Liberaciones atendidas por los magazines
+  unsigned int free_misses; // Liberaciones atendidas por el deposito o los almacenes de bloques
+} kmemstore_cpu;
+
 typedef struct {
   unsigned int blocksize; // Tamaño del bloque
   unsigned int count; // Cantidad de bloques
-  unsigned int free; // Cantidad de bloques libres
-  struct kpool * pool; // Almacen de bloques
+  unsigned int free; // Cantidad de bloques libres en los almacenes de bloques
+  unsigned int pages; // Paginas de cada almacen de bloques (potencia de 2)
+  kpool_list pools; // Almacenes de bloques
+  kmemstore_cpu cpu[KMEMSTORE_CPUS]; // Magazines de cada procesador
+  kmagazine * depot_full; // Deposito: magazines llenos
+  kmagazine * depot_empty; // Deposito: magazines vacios
+  unsigned int depot_gets; // Magazines tomados del deposito
+  unsigned int depot_puts; // Magazines entregados al deposito
 } kmemstore;
 
+/** @brief Estadisticas de un almacen de memoria. La tasa de aciertos de
+ * los magazines es alloc_hits / (alloc_hits + alloc_misses). */
+typedef struct {
+  unsigned int alloc_hits; // Reservas atendidas por los magazines
+  unsigned int alloc_misses; // Reservas atendidas por el deposito o los almacenes de bloques
+  unsigned int free_hits; // Liberaciones atendidas por los magazines
+  unsigned int free_misses; // Liberaciones atendidas por el deposito o los almacenes de bloques
+  unsigned int depot_gets; // Magazines tomados del deposito
+  unsigned int depot_puts; // Magazines entregados al deposito
+} kmemstore_stats;
+
 /** 
 * @brief Inicializa un almacen de memoria.
 * @param blocksize Tamaño del bloque.
@@ -45,9 +96,18 @@ int memstore_free(kmemstore * ms, void * ptr);
 
 
 /**
- * @brief Libera los almacenes bloques no usados. 
+ * @brief Libera los almacenes bloques no usados. Los bloques de los
+ * magazines se devuelven primero a sus almacenes de bloques.
  * @param ms Almacen de memoria.
  */
 void memstore_shrink(kmemstore * ms);
 
+/**
+ * @brief Obtiene las estadisticas de un almacen de memoria, sumando los
+ * contadores de todos los procesadores.
+ * @param ms Almacen de memoria.
+ * @param stats Estructura en la cual se almacenan las estadisticas.
+ */
+void memstore_get_stats(kmemstore * ms, kmemstore_stats * stats);
+
 #endif /* KPOOL_H_ */
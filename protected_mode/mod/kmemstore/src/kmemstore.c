@@ -9,13 +9,27 @@
 * Un almacén de memoria contiene uno o varios almacenes de bloques del tamaño especificado.
 * Cuando el almacén se queda sin espacio, se adiciona automáticamente un nuevo
 * almacén de bloques.
+* Delante de los almacenes de bloques, cada procesador tiene dos magazines
+* (pilas de bloques libres) y el almacén tiene un depósito de magazines
+* llenos y vacíos (Bonwick, Adams. Magazines and Vmem, 2001).
 */
 
+#include <asm.h>
 #include <console.h>
 #include <kmemstore.h>
+#include <string.h>
 
-/** @brief Almacen de bloques para los almacenes de memoria. */
-kpool * kernel_memstore = 0;
+/** @brief Almacenes de bloques para los almacenes de memoria. */
+kpool_list kernel_memstore = {0, 0, 0, PAGE_SIZE};
+
+/** @brief Almacenes de bloques para los magazines. */
+kpool_list kernel_magazines = {0, 0, 0, PAGE_SIZE};
+
+/** @brief Obtiene el procesador actual. El kernel se ejecuta en un solo
+ * procesador. */
+static inline int memstore_cpu(void) {
+  return 0;
+}
 
 /**
  * @brief Reserva o aumenta la capacidad de almacen de memoria.
@@ -27,34 +41,51 @@ kpool * kernel_memstore = 0;
  */
 int memstore_grow(kmemstore * ms);
 
+/**
+ * @brief Calcula la cantidad de paginas de cada almacen de bloques: la menor
+ * potencia de 2 en la cual caben KMEMSTORE_MIN_BLOCKS bloques ademas de la
+ * estructura de datos del almacen, sin superar KMEMSTORE_MAX_PAGES (salvo
+ * que no quepa un solo bloque).
+ * @param blocksize Tamaño de cada bloque
+ * @return Cantidad de paginas
+ */
+static unsigned int memstore_pages(unsigned int blocksize) {
+  unsigned int pages = 1;
+  unsigned int count;
+
+  while (1) {
+    count = (pages * PAGE_SIZE - KPOOL_HEADER_SIZE) / blocksize;
+    if (count >= KMEMSTORE_MIN_BLOCKS || 
+        (count > 0 && pages >= KMEMSTORE_MAX_PAGES)) {
+      return pages;
+    }
+    pages <<= 1;
+  }
+}
+
 /** @brief Crea e inicializa un almacen de memoria. 
- * El almacen ocupa una pagina para blocksize <= PAGE_SIZE y la cantidad
- * de paginas necesarias para un bloque si blocksize > PAGE_SIZE
+ * Cada almacen de bloques ocupa memstore_pages(blocksize) paginas, alineadas
+ * a su tamaño.
  * @param blocksize Tamaño de cada bloque de memoria
  * @return Nuevo almacen de memoria, dentro del cual se ha inicializado un almacen de bloques.
 */
 kmemstore * new_memstore(unsigned int blocksize) {
 
   /* Obtener la referencia a un nuevo almacen de memoria. */
-   kmemstore * ret = kpool_alloc(kernel_memstore);
+   kmemstore * ret = kpool_list_alloc(&kernel_memstore);
 
   /* Si no hay espacio en el almacen del kernel, crear un nuevo almacen */
   if (ret == 0) {
 
-    /* Crear un nuevo almacen de bloques (para obtener un nuevo almacen de memoria)*/
-    kpool * new_ms_pool = new_kpool();
-    if (new_ms_pool == 0) {
+    //Reservar una pagina para guardar los almacenes. La estructura de datos
+    //del almacen de bloques se ubica al inicio de la pagina.
+    unsigned char * mem = (unsigned char*) kmem_allocate_page();
+    if (mem == 0) {
       return 0;
     }
 
-    //Reservar una pagina para guardar los almacenes
-    unsigned char * mem = (unsigned char*) kmem_allocate_page();
-
-    kpool_init(new_ms_pool, mem, sizeof(kmemstore), (PAGE_SIZE / sizeof(kmemstore)));
-
-    /* Adicionar el nuevo almacen al inicio del la lista de almacenes reemplazar la cabeza de la lista. */
-    kernel_memstore = kpool_add(kernel_memstore, new_ms_pool);
-    ret =  kpool_alloc(kernel_memstore);
+    kpool_list_add(&kernel_memstore, mem, sizeof(kmemstore));
+    ret =  kpool_list_alloc(&kernel_memstore);
   }  
 
   /* No se pudo obtener o crear el almacen de memoria. */
@@ -66,25 +97,74 @@ kmemstore * new_memstore(unsigned int blocksize) {
   ret->blocksize = blocksize;
   ret->count  = 0; //por inicializar
   ret->free = 0; //por inicializar
-  ret->pool = 0; //por inicializar
+  ret->pages = memstore_pages(blocksize);
+  kpool_list_init(&ret->pools, ret->pages * PAGE_SIZE);
+  memset(ret->cpu, 0, sizeof(ret->cpu));
+  ret->depot_full = 0;
+  ret->depot_empty = 0;
+  ret->depot_gets = 0;
+  ret->depot_puts = 0;
 
   if (!memstore_grow(ret)) {
     console_printf("No se pudo reservar espacio para el almacen de memoria \n");
-    kpool_free(kernel_memstore, ret);
+    kpool_list_free(&kernel_memstore, ret);
     return 0;
   }
   
   return ret;
 }
 
-/** 
-* @brief Reserva un bloque de memoria en un almacén.
-* @param ms Almacén de memoria.
-* @return Referencia al nuevo bloque, 0 si no se puede reservar.
-*/
-void * memstore_alloc(kmemstore * ms) {
+/**
+ * @brief Obtiene un magazine vacio.
+ * @return Nuevo magazine, 0 si no existe memoria disponible.
+ */
+static kmagazine * magazine_new(void) {
+  kmagazine * m = kpool_list_alloc(&kernel_magazines);
+
+  if (m == 0) {
+    unsigned char * mem = (unsigned char*) kmem_allocate_page();
+    if (mem == 0) {
+      return 0;
+    }
+    kpool_list_add(&kernel_magazines, mem, sizeof(kmagazine));
+    m = kpool_list_alloc(&kernel_magazines);
+  }
 
-  void * ptr = kpool_alloc(ms->pool);
+  if (m != 0) {
+    m->rounds = 0;
+    m->next = 0;
+  }
+
+  return m;
+}
+
+/**
+ * @brief Devuelve los bloques de un magazine a los almacenes de bloques y
+ * libera el magazine.
+ * @param ms Almacen de memoria.
+ * @param m Magazine, puede ser 0.
+ */
+static void magazine_destroy(kmemstore * ms, kmagazine * m) {
+  if (m == 0) {
+    return;
+  }
+  while (m->rounds > 0) {
+    m->rounds--;
+    if (kpool_list_free(&ms->pools, m->blocks[m->rounds])) {
+      ms->free++;
+    }
+  }
+  kpool_list_free(&kernel_magazines, m);
+}
+
+/**
+ * @brief Reserva un bloque directamente de los almacenes de bloques.
+ * @param ms Almacén de memoria.
+ * @return Referencia al nuevo bloque, 0 si no se puede reservar.
+ */
+static void * memstore_pool_alloc(kmemstore * ms) {
+
+  void * ptr = kpool_list_alloc(&ms->pools);
 
   /* Si se obtiene un apuntador valido, decrementar la cantidad de bloques libres
    y retornar el apuntador. */
@@ -99,7 +179,7 @@ void * memstore_alloc(kmemstore * ms) {
   }
 
   /* Tratar de nuevo de reservar memoria. */
-  ptr = kpool_alloc(ms->pool);
+  ptr = kpool_list_alloc(&ms->pools);
 
   /* Si se obtiene un nuevo bloque de memoria, decrementar la cantidad de bloques libres. */
   if (ptr != 0) {
@@ -110,15 +190,131 @@ void * memstore_alloc(kmemstore * ms) {
 
 }
 
+/** 
+* @brief Reserva un bloque de memoria en un almacén.
+* Se toma del magazine cargado del procesador, o del anterior si el cargado
+* esta vacio. Si ambos estan vacios, se intercambia el anterior por un
+* magazine lleno del deposito, y si no existe se reserva el bloque de los
+* almacenes de bloques.
+* @param ms Almacén de memoria.
+* @return Referencia al nuevo bloque, 0 si no se puede reservar.
+*/
+void * memstore_alloc(kmemstore * ms) {
+  kmemstore_cpu * c;
+  kmagazine * m;
+  void * ptr;
+  unsigned int flags;
+
+  flags = disable_interrupts();
+
+  c = &ms->cpu[memstore_cpu()];
+
+  //El magazine cargado esta vacio, intercambiarlo con el anterior
+  if ((c->loaded == 0 || c->loaded->rounds == 0) &&
+      c->previous != 0 && c->previous->rounds > 0) {
+    m = c->loaded;
+    c->loaded = c->previous;
+    c->previous = m;
+  }
+
+  //Ambos magazines estan vacios, tomar uno lleno del deposito
+  if ((c->loaded == 0 || c->loaded->rounds == 0) && ms->depot_full != 0) {
+    m = ms->depot_full;
+    ms->depot_full = m->next;
+    ms->depot_gets++;
+    //El magazine anterior (vacio) se entrega al deposito
+    if (c->previous != 0) {
+      c->previous->next = ms->depot_empty;
+      ms->depot_empty = c->previous;
+      ms->depot_puts++;
+    }
+    c->previous = c->loaded;
+    c->loaded = m;
+  }
+
+  if (c->loaded != 0 && c->loaded->rounds > 0) {
+    c->loaded->rounds--;
+    ptr = c->loaded->blocks[c->loaded->rounds];
+    c->alloc_hits++;
+  }else {
+    ptr = memstore_pool_alloc(ms);
+    c->alloc_misses++;
+  }
+
+  restore_interrupts(flags);
+
+  return ptr;
+}
+
 /**
- * @brief Libera un bloque de memoria del almacén.
+ * @brief Libera un bloque de memoria del almacén. El bloque se almacena en
+ * el magazine cargado del procesador, o en el anterior si el cargado esta
+ * lleno. Si ambos estan llenos, se intercambia el anterior por un magazine
+ * vacio del deposito (o uno nuevo), y si no es posible el bloque se
+ * devuelve a su almacen de bloques, que se obtiene enmascarando su
+ * direccion.
  */
 int  memstore_free(kmemstore * ms, void * ptr) {
-  if (kpool_free(ms->pool, ptr)) {
-    ms->free++;
-    return 1;
+  kmemstore_cpu * c;
+  kmagazine * m;
+  kpool * p;
+  unsigned int flags;
+  int ret = 1;
+
+  //Verificar que el bloque pertenece a un almacen de bloques de este tamaño
+  p = kpool_list_owner(&ms->pools, ptr);
+  if (p == 0 || p->blocksize != ms->blocksize) {
+    return 0;
   }
-  return 0;
+
+  flags = disable_interrupts();
+
+  c = &ms->cpu[memstore_cpu()];
+
+  //El magazine cargado esta lleno, intercambiarlo con el anterior
+  if ((c->loaded == 0 || c->loaded->rounds == KMEMSTORE_MAGAZINE_SIZE) &&
+      c->previous != 0 && c->previous->rounds < KMEMSTORE_MAGAZINE_SIZE) {
+    m = c->loaded;
+    c->loaded = c->previous;
+    c->previous = m;
+  }
+
+  //Ambos magazines estan llenos, tomar uno vacio del deposito
+  if (c->loaded == 0 || c->loaded->rounds == KMEMSTORE_MAGAZINE_SIZE) {
+    m = ms->depot_empty;
+    if (m != 0) {
+      ms->depot_empty = m->next;
+      ms->depot_gets++;
+    }else {
+      m = magazine_new();
+    }
+    if (m != 0) {
+      //El magazine anterior (lleno) se entrega al deposito
+      if (c->previous != 0) {
+        c->previous->next = ms->depot_full;
+        ms->depot_full = c->previous;
+        ms->depot_puts++;
+      }
+      c->previous = c->loaded;
+      c->loaded = m;
+    }
+  }
+
+  if (c->loaded != 0 && c->loaded->rounds < KMEMSTORE_MAGAZINE_SIZE) {
+    c->loaded->blocks[c->loaded->rounds] = ptr;
+    c->loaded->rounds++;
+    c->free_hits++;
+  }else {
+    ret = kpool_list_free(&ms->pools, ptr);
+    if (ret) {
+      ms->free++;
+    }
+    c->free_misses++;
+  }
+
+  restore_interrupts(flags);
+
+  return ret;
 }
 
 /**
@@ -128,54 +324,26 @@ int memstore_grow(kmemstore * ms) {
     return 0; //???
   }
 
-  /* Obtener un nuevo almacen de bloques */
-  kpool * pool = new_kpool();
+  int pages = ms->pages;
 
-  if (pool == 0) {
-      console_printf("No se pudo crear el almacen de bloques\n");
-      return 0;
-  }
-
-  int blocksize = ms->blocksize;
-
-  int pages;
-  int count;
-
-  /* Determinar la cantidad de paginas que necesita el almacen */
-  if (blocksize <= PAGE_SIZE) {
-    count = PAGE_SIZE / blocksize;
-    pages = 1;
-  }else {
-    pages = blocksize / PAGE_SIZE;
-    if (blocksize % PAGE_SIZE != 0) {
-      pages++;
-    }    
-    count = (pages * PAGE_SIZE) / blocksize;
+  /* Obtener las paginas de memoria para el almacen, alineadas a su tamaño.
+   * Se prefieren marcos contiguos, que se mapean con una sola operacion (o
+   * ya se encuentran en el mapa directo) */
+  unsigned char * ptr = (unsigned char *)kmem_allocate_pages_aligned(pages, pages, KMEM_CONTIGUOUS);
+  if (ptr == 0) {
+    ptr = (unsigned char *)kmem_allocate_pages_aligned(pages, pages, KMEM_SPARSE);
   }
-
-  /* Obtener las paginas de memoria para el almacen*/
-  unsigned char * ptr = (unsigned char *)kmem_allocate_pages(pages, KMEM_SPARSE);
   if (ptr == 0) {
-    delete_kpool(pool);
     console_printf("No se pudieron obtener %d paginas del kernel para el almacen\n", pages);
     return 0;
   }
 
-  /* Inicializar el nuevo almacen de bloques */
-  kpool_init(pool, ptr, blocksize, count);
+  /* Crear el almacen de bloques al inicio de las paginas y adicionarlo al
+   * almacen de memoria. */
+  kpool * pool = kpool_list_add(&ms->pools, ptr, ms->blocksize);
 
-  /* Asociar el almacen de bloques al almacen de memoria*/
-  if (ms->pool == 0) {
-    /* El almacen es nuevo, solo contiene el almacen de bloques que se acaba de crear.*/
-    ms->count = count;
-    ms->free = count;
-    ms->pool = pool;
-  }else {
-    /* Adicionar el almacen de bloques que se acaba de crear. */
-    ms->count += count;
-    ms->free += count;
-    ms->pool = kpool_add(ms->pool, pool);
-  }
+  ms->count += pool->count;
+  ms->free += pool->count;
 
   return 1;
 }
@@ -186,47 +354,56 @@ int memstore_grow(kmemstore * ms) {
  * @param ms Almacen de memoria.
  */
 void memstore_shrink(kmemstore * ms) {
-  kpool * ant = 0;
-  kpool * p = ms->pool;
-
-  while (p != 0) {
-    ant = p;
-    int is_deleted = 0;
-    //Liberar el almacen si todos los bloques estan sin usar.
-    if (p->free == p->count) {
-      int blocksize = p->blocksize;
-
-      int pages;
-      int count;
-      /* Determinar la cantidad de paginas que usa el almacen de bloques */
-      if (blocksize <= PAGE_SIZE) {
-        //El almacen de bloques usa una sola pagina.
-        pages = 1;
-      }else {
-        //El almacen de bloques usa mas de una pagina.
-        pages = blocksize / PAGE_SIZE;
-        if (blocksize % PAGE_SIZE != 0) {
-          pages++;
-        }
-      }
-      if (kmem_free_pages((unsigned int)p->pool, pages)) {
-        //Quitar la cantidad de bloques de este almacen de bloques
-        ms->free -= p->free;
-        ms->count -= p->count;
-        ant->next = p->next;
-
-        //Si este almacen es el inicio de la lista, actualizar.
-        if (p == ms->pool){
-          ms->pool = p->next;
-        }
-        is_deleted = 1;
-      }
-    }
-    kpool * aux = p;
-    //Avanzar al siguiente almacen
-    p = p->next;
-    if (is_deleted){ 
-      delete_kpool(aux);
-    }
+  kpool * p;
+  kmagazine * m;
+  unsigned int flags;
+  int i;
+
+  flags = disable_interrupts();
+
+  //Devolver los bloques de los magazines a los almacenes de bloques
+  for (i = 0; i < KMEMSTORE_CPUS; i++) {
+    magazine_destroy(ms, ms->cpu[i].loaded);
+    magazine_destroy(ms, ms->cpu[i].previous);
+    ms->cpu[i].loaded = 0;
+    ms->cpu[i].previous = 0;
   }
-}
\ No newline at end of file
+  while ((m = ms->depot_full) != 0) {
+    ms->depot_full = m->next;
+    magazine_destroy(ms, m);
+  }
+  while ((m = ms->depot_empty) != 0) {
+    ms->depot_empty = m->next;
+    magazine_destroy(ms, m);
+  }
+
+  //Los almacenes con todos sus bloques libres se encuentran en su propia
+  //lista
+  while ((p = kpool_list_take_empty(&ms->pools)) != 0) {
+    //Quitar la cantidad de bloques de este almacen de bloques
+    ms->free -= p->free;
+    ms->count -= p->count;
+    //La estructura de datos se encuentra al inicio de las paginas
+    kmem_free_pages((unsigned int)p, ms->pages);
+  }
+
+  restore_interrupts(flags);
+}
+
+/**
+ * @brief Obtiene las estadisticas de un almacen de memoria.
+ */
+void memstore_get_stats(kmemstore * ms, kmemstore_stats * stats) {
+  int i;
+
+  memset(stats, 0, sizeof(kmemstore_stats));
+
+  for (i = 0; i < KMEMSTORE_CPUS; i++) {
+    stats->alloc_hits += ms->cpu[i].alloc_hits;
+    stats->alloc_misses += ms->cpu[i].alloc_misses;
+    stats->free_hits += ms->cpu[i].free_hits;
+    stats->free_misses += ms->cpu[i].free_misses;
+  }
+  stats->depot_gets = ms->depot_gets;
+  stats->depot_puts = ms->depot_puts;
+}
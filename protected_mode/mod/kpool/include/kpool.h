@@ -20,8 +20,26 @@ typedef struct kpool {
   unsigned char * freeptr; //Apuntador al siguiente bloque libre
   unsigned char * pool; // Region de memoria para almacenar los bloques
   struct kpool * next; // Apuntador al siguiente almacen
+  struct kpool * prev; // Apuntador al almacen anterior (listas de almacenes)
 } kpool;
 
+/** @brief Espacio que ocupa la estructura de datos de un almacen ubicado al
+ * inicio de su propia memoria. Se redondea a 16 bytes para conservar la
+ * alineación de los bloques. */
+#define KPOOL_HEADER_SIZE ((sizeof(kpool) + 15) & ~15)
+
+/** @brief Lista de almacenes de bloques del mismo tamaño, separados según
+ * su ocupación. Cada almacen ocupa size bytes a partir de una dirección
+ * múltiplo de size, y su estructura de datos se encuentra al inicio de esa
+ * memoria: el almacen de un bloque se obtiene enmascarando su dirección, y
+ * reservar o liberar un bloque toma tiempo constante. */
+typedef struct {
+  kpool * partial; // Almacenes con bloques libres y ocupados
+  kpool * full; // Almacenes sin bloques libres
+  kpool * empty; // Almacenes con todos sus bloques libres
+  unsigned int size; // Tamaño y alineación de cada almacen (potencia de 2)
+} kpool_list;
+
 
 /** 
  * @brief Obtiene un almacen desde el almacen central del kernel.
@@ -66,4 +84,57 @@ void * kpool_alloc(kpool * p);
 */
 int kpool_free(kpool * p, void * ptr);
 
+/** 
+* @brief Inicializa una lista de almacenes vacía.
+* @param l Lista de almacenes.
+* @param size Tamaño en bytes de cada almacen (potencia de 2, al menos
+* PAGE_SIZE).
+*/
+void kpool_list_init(kpool_list * l, unsigned int size);
+
+/** 
+* @brief Crea un almacen en una región de memoria de l->size bytes alineada
+* a l->size, con su estructura de datos al inicio, y lo adiciona a la lista
+* de almacenes vacíos.
+* @param l Lista de almacenes.
+* @param mem Memoria para el almacen.
+* @param blocksize Tamaño del bloque.
+* @return Almacen creado, 0 si en la memoria no cabe ningún bloque.
+*/
+kpool * kpool_list_add(kpool_list * l, unsigned char * mem,
+               unsigned int blocksize);
+
+/** 
+* @brief Reserva un bloque de un almacen parcialmente lleno, o de uno vacío
+* si no existe ninguno.
+* @param l Lista de almacenes.
+* @return Referencia al nuevo bloque, 0 si todos los almacenes están llenos.
+*/
+void * kpool_list_alloc(kpool_list * l);
+
+/** 
+* @brief Libera un bloque reservado con kpool_list_alloc.
+* @param l Lista de almacenes.
+* @param ptr Referencia al bloque que se desea liberar.
+* @return 1 si se liberó el bloque, 0 si no pertenece al almacen.
+*/
+int kpool_list_free(kpool_list * l, void * ptr);
+
+/** 
+* @brief Obtiene el almacen de la lista que contiene un bloque.
+* @param l Lista de almacenes.
+* @param ptr Referencia al bloque.
+* @return Almacen que contiene el bloque, 0 si ptr no es un bloque del
+* almacen ubicado al inicio de su memoria.
+*/
+kpool * kpool_list_owner(kpool_list * l, void * ptr);
+
+/** 
+* @brief Retira un almacen vacío de la lista, para liberar su memoria.
+* @param l Lista de almacenes.
+* @return Almacen retirado (su dirección es la de su memoria), 0 si no
+* existen almacenes vacíos.
+*/
+kpool * kpool_list_take_empty(kpool_list * l);
+
 #endif /* KPOOL_H_ */
@@ -88,6 +88,7 @@ kpool * kpool_init(kpool * p,
   p->initialized = 0;
   p->freeptr = pool;
   p->next = 0;
+  p->prev = 0;
   return p;
 }
 
@@ -183,3 +184,149 @@ int kpool_free(kpool * p, void * ptr) {
   return 1;
 }
 
+/** @brief Obtiene la lista en la cual se debe encontrar un almacen, según
+ * su cantidad de bloques libres. */
+static inline kpool ** kpool_list_of(kpool_list * l, kpool * p)
+{
+  if (p->free == 0) {
+    return &l->full;
+  }
+  if (p->free == p->count) {
+    return &l->empty;
+  }
+  return &l->partial;
+}
+
+/** @brief Retira un almacen de una lista. */
+static inline void kpool_unlink(kpool ** head, kpool * p)
+{
+  if (p->prev != 0) {
+    p->prev->next = p->next;
+  }else {
+    *head = p->next;
+  }
+  if (p->next != 0) {
+    p->next->prev = p->prev;
+  }
+  p->next = 0;
+  p->prev = 0;
+}
+
+/** @brief Adiciona un almacen al inicio de una lista. */
+static inline void kpool_link(kpool ** head, kpool * p)
+{
+  p->prev = 0;
+  p->next = *head;
+  if (*head != 0) {
+    (*head)->prev = p;
+  }
+  *head = p;
+}
+
+/** @brief Inicializa una lista de almacenes vacía. */
+void kpool_list_init(kpool_list * l, unsigned int size) {
+  l->partial = 0;
+  l->full = 0;
+  l->empty = 0;
+  l->size = size;
+}
+
+/** @brief Crea un almacen al inicio de una región de memoria y lo adiciona
+ * a la lista de almacenes vacíos. */
+kpool * kpool_list_add(kpool_list * l, unsigned char * mem,
+               unsigned int blocksize) {
+  kpool * p = (kpool *)mem;
+  unsigned int count = (l->size - KPOOL_HEADER_SIZE) / blocksize;
+
+  if (count == 0) {
+    return 0;
+  }
+
+  kpool_init(p, mem + KPOOL_HEADER_SIZE, blocksize, count);
+  kpool_link(&l->empty, p);
+
+  return p;
+}
+
+/** @brief Reserva un bloque de la lista de almacenes. */
+void * kpool_list_alloc(kpool_list * l) {
+  kpool * p;
+  kpool ** head;
+  void * ret;
+
+  //Preferir los almacenes parcialmente llenos, para que los vacios se
+  //puedan liberar
+  p = l->partial;
+  if (p == 0) {
+    p = l->empty;
+  }
+  if (p == 0) {
+    return 0;
+  }
+
+  head = kpool_list_of(l, p);
+
+  //El almacen tiene bloques libres, kpool_alloc no recorre la lista
+  ret = kpool_alloc(p);
+
+  //Mover el almacen si cambio su ocupacion
+  if (kpool_list_of(l, p) != head) {
+    kpool_unlink(head, p);
+    kpool_link(kpool_list_of(l, p), p);
+  }
+
+  return ret;
+}
+
+/** @brief Libera un bloque de la lista de almacenes. */
+int kpool_list_free(kpool_list * l, void * ptr) {
+  kpool * p;
+  kpool ** head;
+
+  p = kpool_list_owner(l, ptr);
+
+  if (p == 0 || p->free == p->count) {
+    return 0;
+  }
+
+  head = kpool_list_of(l, p);
+
+  //El almacen contiene el bloque, kpool_free no recorre la lista
+  kpool_free(p, ptr);
+
+  if (kpool_list_of(l, p) != head) {
+    kpool_unlink(head, p);
+    kpool_link(kpool_list_of(l, p), p);
+  }
+
+  return 1;
+}
+
+/** @brief Obtiene el almacen de la lista que contiene un bloque. */
+kpool * kpool_list_owner(kpool_list * l, void * ptr) {
+  kpool * p;
+
+  if (ptr == 0) {
+    return 0;
+  }
+
+  //La estructura de datos del almacen se encuentra al inicio de su memoria
+  p = (kpool *)((unsigned int)ptr & ~(l->size - 1));
+
+  if (!kpool_contains(p, ptr)) {
+    return 0;
+  }
+
+  return p;
+}
+
+/** @brief Retira un almacen vacío de la lista. */
+kpool * kpool_list_take_empty(kpool_list * l) {
+  kpool * p = l->empty;
+
+  if (p != 0) {
+    kpool_unlink(&l->empty, p);
+  }
+
+  return p;
+}
@@ -14,15 +14,77 @@
 /** @brief Bit para activar la paginación en el registro CR0 */
 #define ENABLE_PAGING 0x80000000
 
+/** @brief Bit para proteger las páginas de solo lectura de las escrituras
+ * del kernel en el registro CR0 */
+#define CR0_WP 0x10000
+
 /** @brief Tamaño de la unidad de asignación de memoria  (página, marco)*/
 #define PAGE_SIZE 4096
 
+/** @brief Si se define, el kernel usa paginación PAE: tres niveles de
+ * tablas con entradas de 64 bits, que permiten usar la memoria física
+ * ubicada por encima de 4 GB. El cambio de paginación de 32 bits a PAE se
+ * realiza en setup_paging. */
+/* #define PAGING_PAE */
+
+/** @brief Si se define, start.S mapea el primer MB, el kernel y los módulos
+ * con páginas de 4 MB cuando el procesador soporta PSE (CPUID), en lugar de
+ * crear las tablas de página iniciales. */
+/* #define PAGING_PSE_BOOT */
+
+/** @brief Si se define, setup_paging crea todas las tablas de página del
+ * espacio del kernel (desde KERNEL_VIRT_OFFSET hasta el mapeo recursivo),
+ * y éstas no se liberan. Mapear una página del kernel no requiere reservar
+ * memoria, y las entradas del directorio del kernel no cambian. Requiere
+ * 1 MB (2 MB en modo PAE) para las tablas. */
+/* #define PAGING_PREALLOCATE_TABLES */
+
+/** @brief Bit para activar las páginas de 4 MB (PSE) en el registro CR4 */
+#define CR4_PSE 0x10
+
+/** @brief Bit para activar las páginas globales (PGE) en el registro CR4 */
+#define CR4_PGE 0x80
+
+/** @brief Tamaño de una página de 4 MB (PSE) */
+#define PSE_PAGE_SIZE 0x400000
+
+#ifdef PAGING_PAE
+
+/** @brief Bit para activar PAE en el registro CR4 */
+#define CR4_PAE 0x20
+
+/** @brief Número de entradas en la tabla de apuntadores a directorios */
+#define PDPT_ENTRIES 4
+
+/* @brief Número total de entradas en los cuatro directorios de tablas de
+ * página, que se acceden como un solo arreglo */
+#define PD_ENTRIES 2048
+
+/* @brief Número de entradas en una tabla de página */
+#define PT_ENTRIES 512
+
+/* @brief Las tablas de página se ubican en los últimos 8 MB de la memoria
+ * virtual. Las cuatro últimas tablas de página son los cuatro directorios
+ * de tablas de página.  */
+#define KERNEL_PAGETABLES_VADDR 0xFF800000
+
+/** @brief Los directorios de tablas de página se ubican como las últimas
+ * cuatro tablas de páginas en la memoria virtual */
+#define KERNEL_PD_VADDR (KERNEL_PAGETABLES_VADDR + 0x7FC000)
+
+#else
+
 /* @brief Número de entradas en el directorio de tablas de página */
 #define PD_ENTRIES 1024
 
 /* @brief Número de entradas en una tabla de página */
 #define PT_ENTRIES 1024
 
+#endif
+
+/** @brief Bytes de memoria virtual que mapea una tabla de páginas */
+#define PT_COVERAGE (PAGE_SIZE * PT_ENTRIES)
+
 /* @brief Bit 'P' en las entradas del directorio y tablas de página */
 #define PG_PRESENT 1
 
@@ -39,6 +101,16 @@
 /* @brief Bits para una entrada con U/S en 1, presente */
 #define PG_USER_PRESENT 7
 
+/* @brief Bit 'PS' en una entrada del directorio: la entrada mapea una página
+ * grande (4 MB con PSE, 2 MB en modo PAE) en lugar de una tabla de páginas */
+#define PG_LARGE 0x80
+
+/* @brief Bit 'G' en una entrada: la página es global, y su entrada en el
+ * TLB se conserva al recargar CR3 si PGE se encuentra activo */
+#define PG_GLOBAL 0x100
+
+#ifndef PAGING_PAE
+
 /* @brief Las tablas de página se ubican en los últimos 4 MB de la memoria
  * virtual. Se usan 1023 tablas de página. La última tabla de páginas es el
  * mismo directorio de tablas de página.  */
@@ -48,6 +120,33 @@
  * páginas en la memoria virtual */
 #define KERNEL_PD_VADDR (KERNEL_PAGETABLES_VADDR + 0x3FF000)
 
+#endif
+
+/** @brief Páginas virtuales reservadas para acceder temporalmente a un
+ * marco de página (kmap_frame). Se ubican en la memoria reservada al final
+ * del espacio del kernel, que no se gestiona en kmem. */
+#define KERNEL_SCRATCH_VADDR 0xFF000000
+
+/** @brief Número de ranuras de mapeo temporal por procesador */
+#define KMAP_SLOTS 16
+
+/** @brief Dirección virtual del mapa directo de la memoria física: el marco
+ * ubicado en la dirección física p se accede en PHYSMAP_VADDR + p. Coincide
+ * con el desplazamiento con el cual start.S mapea el kernel. */
+#define PHYSMAP_VADDR KERNEL_VIRT_OFFSET
+
+/** @brief Cantidad máxima de memoria física que se incluye en el mapa
+ * directo (512 MB). El resto del espacio del kernel lo gestiona kmem. */
+#define PHYSMAP_SIZE 0x20000000
+
+/** @brief Número de páginas a partir del cual unmap_range y destroy_range
+ * invalidan todo el TLB en lugar de invalidar cada página con INVLPG */
+#define TLB_FLUSH_THRESHOLD 32
+
+/** @brief Máximo número de marcos llenos de ceros que se mantienen
+ * disponibles */
+#define ZEROED_FRAMES_MAX 32
+
 /** @brief Redondea una dirección dada al inicio de la página */
 #define ROUND_DOWN_TO_PAGE(value) ((int)(value / PAGE_SIZE) * PAGE_SIZE)
 
@@ -57,28 +156,96 @@
 /** @brief Excepcion de fallo de pagina. */
 #define PAGE_FAULT_EXCEPTION 14
 
+/** @brief Bit del código de error de un fallo de página: la página se
+ * encontraba presente (violación de protección) */
+#define PF_PRESENT 1
+
+/** @brief Bit del código de error de un fallo de página: el fallo ocurrió
+ * en una escritura */
+#define PF_WRITE 2
+
 /* No incluir de aqui en adelante si se incluye este archivo desde codigo
  * en ensamblador */
 #ifndef ASM
 
+#ifdef PAGING_PAE
+
+/** @brief Entrada de una tabla de páginas */
+typedef unsigned long long page_table_entry;
+
+/** @brief Entrada en el directorio de tablas de página */
+typedef unsigned long long page_directory_entry;
+
+/** @brief Bits de la dirección física del marco en una entrada */
+#define PG_FRAME_MASK 0x000FFFFFFFFFF000ULL
+
+#else
+
 /** @brief Entrada de una tabla de páginas */
 typedef unsigned int page_table_entry;
 
 /** @brief Entrada en el directorio de tablas de página */
 typedef unsigned int page_directory_entry;
 
+/** @brief Bits de la dirección física del marco en una entrada */
+#define PG_FRAME_MASK 0xFFFFF000
+
+#endif
+
+/** @brief Obtiene el número del marco (dirección física / PAGE_SIZE) al
+ * cual apunta una entrada */
+#define PG_FRAME_NUMBER(entry) ((unsigned int)(((entry) & PG_FRAME_MASK) >> 12))
+
 /** @brief Tipo de datos para el directorio de tablas de página */
 typedef page_directory_entry * page_directory;
 
 /** @brief Tipo de datos para la tabla de páginas */
 typedef page_table_entry * page_table;
 
+/** @brief Ranuras de mapeo temporal de un procesador. Las ranuras se usan
+ * como una pila. */
+typedef struct {
+    /** @brief Dirección virtual de la primera ranura */
+    unsigned int base;
+    /** @brief Número de ranuras en uso */
+    int used;
+}kmap_slots;
+
 /** @brief Dirección física de directorio de tablas de página del kernel */
 extern unsigned int kernel_pd_addr;
 
 /** @brief Apuntador al inicio del directorio de tablas de página */
 extern page_directory kernel_pd;
 
+/** @brief Dirección física en la cual termina el mapa directo */
+extern unsigned int physmap_end;
+
+/** @brief Dirección física del marco de ceros compartido, que se mapea de
+ * solo lectura en las páginas que aún no se han escrito */
+extern unsigned int kernel_zero_frame;
+
+/** @brief Verifica si un marco se encuentra en el mapa directo
+ * @param addr Dirección física
+ * @return 1 si la dirección se puede acceder mediante phys_to_virt
+ */
+static __inline__ int physmap_contains(unsigned int addr) {
+    return addr < physmap_end;
+}
+
+/** @brief Obtiene la dirección virtual de una dirección física del mapa
+ * directo (ver physmap_contains).
+ */
+static __inline__ unsigned int phys_to_virt(unsigned int addr) {
+    return addr + PHYSMAP_VADDR;
+}
+
+/** @brief Obtiene la dirección física de una dirección virtual del mapa
+ * directo. No es válida para las páginas mapeadas con map_page.
+ */
+static __inline__ unsigned int virt_to_phys(unsigned int vaddr) {
+    return vaddr - PHYSMAP_VADDR;
+}
+
 /** @brief Macro para invalidar una página en el TLB */
 #define invalidate_page(addr) \
   inline_assembly ("invlpg (%0)" : : "a" (ROUND_DOWN_TO_PAGE(addr)))
@@ -94,6 +261,74 @@ void setup_paging();
  */
 int map_page(unsigned int vaddr, unsigned int addr);
 
+/** @brief Mapear una página a un marco de páginas, indicado por su número.
+ * En modo PAE permite mapear marcos ubicados por encima de 4 GB.
+ * @param vaddr Dirección virtual de la página a mapear
+ * @param frame Número del marco (dirección física / PAGE_SIZE)
+ * @return 1 en caso de éxito, 0 si ocurre un error.
+ */
+int map_page_frame(unsigned int vaddr, unsigned int frame);
+
+/** @brief Indica si se pueden mapear páginas grandes: 4 MB si el
+ * procesador soporta PSE, o 2 MB en modo PAE.
+ * @return 1 si se soportan páginas grandes, 0 en caso contrario
+ */
+int large_pages_supported(void);
+
+/** @brief Mapea una página grande de PT_COVERAGE bytes directamente en el
+ * directorio de tablas de página, sin usar una tabla de páginas.
+ * @param vaddr Dirección virtual, alineada a PT_COVERAGE
+ * @param addr Dirección física de la región, alineada a PT_COVERAGE
+ * @return 1 en caso de éxito, 0 si no se soportan páginas grandes o la
+ * entrada del directorio ya se encuentra en uso.
+ */
+int map_large_page(unsigned int vaddr, unsigned int addr);
+
+/** @brief Quita una página grande del espacio virtual. La región física
+ * no se libera.
+ * @param vaddr Dirección virtual de la página grande
+ * @return Dirección física de la región, 0 si la dirección no se encuentra
+ * mapeada con una página grande.
+ */
+unsigned int unmap_large_page(unsigned int vaddr);
+
+/** @brief Mapea el marco de ceros compartido en una página, de solo
+ * lectura. La primera escritura en la página genera un fallo de página, en
+ * el cual se reemplaza por un marco propio lleno de ceros (copia en
+ * escritura).
+ * @param vaddr Dirección virtual de la página
+ * @return 1 en caso de éxito, 0 si ocurre un error.
+ */
+int map_zero_page(unsigned int vaddr);
+
+/** @brief Mapea un rango de páginas a marcos de página contiguos. Las
+ * entradas se escriben en forma consecutiva dentro de cada tabla de páginas.
+ * Si alguna página ya se encuentra mapeada, no se mapea ninguna.
+ * @param vaddr Dirección virtual de la primera página
+ * @param addr Dirección física del primer marco
+ * @param count Número de páginas
+ * @param flags Bits de las entradas, por ejemplo PG_KERNEL_PRESENT
+ * @return 1 en caso de éxito, 0 si ocurre un error.
+ */
+int map_range(unsigned int vaddr, unsigned int addr, int count,
+        unsigned int flags);
+
+/** @brief Quita un rango de páginas del espacio virtual, e invalida el TLB
+ * una sola vez. Las páginas no mapeadas se ignoran.
+ * @param vaddr Dirección virtual de la primera página
+ * @param count Número de páginas
+ * @return 1 en caso de éxito, 0 si el rango no es válido.
+ */
+int unmap_range(unsigned int vaddr, int count);
+
+/** @brief Quita un rango de páginas del espacio virtual y libera los
+ * marcos asociados, como unmap_range.
+ * @param vaddr Dirección virtual de la primera página
+ * @param count Número de páginas
+ * @return 1 en caso de éxito, 0 si el rango no es válido.
+ */
+int destroy_range(unsigned int vaddr, int count);
+
 /** @brief Quitar una página del espacio virtual.
  * @param vaddr Dirección virtual de la página a quitar.
  * @return 1 en caso de éxito, 0 si ocurre un error.
@@ -106,6 +341,51 @@ int unmap_page(unsigned int vaddr);
  */
 int destroy_page(unsigned int vaddr);
 
+/** @brief Mapea temporalmente un marco de página en una ranura del
+ * procesador actual, escribiendo una sola entrada. Si el marco se encuentra
+ * en el mapa directo, retorna su dirección en él. Los mapeos se deben
+ * quitar en orden inverso con kunmap_frame; se puede invocar desde un
+ * manejador de interrupción.
+ * @param frame Número del marco (dirección física / PAGE_SIZE)
+ * @return Dirección virtual del marco, 0 si no existen ranuras libres.
+ */
+unsigned int kmap_frame(unsigned int frame);
+
+/** @brief Quita el mapeo temporal de un marco, e invalida la entrada del
+ * TLB del procesador actual.
+ * @param vaddr Dirección retornada por kmap_frame
+ */
+void kunmap_frame(unsigned int vaddr);
+
+/** @brief Reserva un marco de página lleno de ceros. El marco se toma del
+ * conjunto de marcos que se llenan de ceros en el ciclo de inactividad del
+ * kernel, o se llena de ceros en este momento si el conjunto está vacío.
+ * Se debe invocar después de setup_paging.
+ * @return Dirección física del marco, 0 si no existen marcos disponibles.
+ */
+unsigned int allocate_zeroed_frame(void);
+
+/** @brief Llena de ceros marcos libres hasta completar ZEROED_FRAMES_MAX
+ * marcos disponibles para allocate_zeroed_frame. Se debe invocar desde el
+ * ciclo de inactividad del kernel.
+ * @return Número de marcos que se llenaron de ceros.
+ */
+int refill_zeroed_frames(void);
+
+/** @brief Rutina que intenta resolver un fallo de página, por ejemplo
+ * mapeando un marco en una región reservada con kmem_reserve.
+ * @param vaddr Dirección que causó el fallo (CR2)
+ * @param error Código de error del fallo (PF_PRESENT, PF_WRITE)
+ * @return 1 si el fallo se resolvió y se puede reintentar la instrucción,
+ * 0 en caso contrario */
+typedef int (*page_fault_resolver)(unsigned int vaddr, unsigned int error);
+
+/** @brief Instala la rutina que intenta resolver los fallos de página
+ * antes de bloquear el kernel.
+ * @param resolver Rutina a instalar, 0 para no usar ninguna.
+ */
+void install_page_fault_resolver(page_fault_resolver resolver);
+
 /** @brief Manejador por defecto para fallo de página. */
 void page_fault_handler(interrupt_state * state);
 
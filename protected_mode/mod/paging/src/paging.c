@@ -16,10 +16,507 @@
 #include <console.h>
 #include <stdlib.h>
 #include <physmem.h>
+#include <memblock.h>
 
 /* @brief Apuntador al inicio del directorio de tablas de página */
 page_directory kernel_pd;
 
+/** @brief Marcos de página llenos de ceros, disponibles para
+ * allocate_zeroed_frame y para crear tablas de página. */
+unsigned int zeroed_frames[ZEROED_FRAMES_MAX];
+
+/** @brief Número de marcos en zeroed_frames */
+int zeroed_frames_count;
+
+/** @brief Dirección física del marco de ceros compartido */
+unsigned int kernel_zero_frame;
+
+/** @brief Rutina que intenta resolver los fallos de página */
+static page_fault_resolver fault_resolver;
+
+/** @brief Ranuras de mapeo temporal del procesador */
+static kmap_slots kernel_kmap_slots;
+
+/** @brief 1 si el procesador soporta escrituras no temporales (MOVNTI) */
+static int zero_nt_supported;
+
+/** @brief 1 si se pueden mapear páginas grandes en el directorio */
+static int large_pages_enabled;
+
+/** @brief Dirección física en la cual termina el mapa directo */
+unsigned int physmap_end;
+
+/** @brief PG_GLOBAL si el procesador soporta PGE, 0 en caso contrario */
+static unsigned int global_flag;
+
+/** @brief Número de entradas presentes en cada tabla de páginas, para
+ * saber si la tabla se puede liberar sin recorrer sus entradas */
+static unsigned short page_table_used[PD_ENTRIES];
+
+/**
+ * @brief Recarga CR3, invalidando todas las entradas del TLB.
+ */
+static __inline__ void flush_tlb(void) {
+    unsigned int cr3;
+
+    inline_assembly("movl %%cr3, %0\n\t" \
+                "movl %0, %%cr3" \
+                : "=r" (cr3) \
+                : \
+                : "memory");
+}
+
+#ifdef PAGING_PAE
+
+/** @brief Tamaño de una página grande en modo PAE (2 MB) */
+#define PAE_LARGE_PAGE_SIZE PT_COVERAGE
+
+/** @brief Tabla de apuntadores a directorios de tablas de página (PDPT) */
+static page_directory_entry pae_pdpt[PDPT_ENTRIES] 
+    __attribute__((aligned(32)));
+
+/** @brief Directorios de tablas de página. El directorio i se ubica en
+ * pae_directories[i * PT_ENTRIES] */
+static page_directory_entry pae_directories[PD_ENTRIES] 
+    __attribute__((aligned(4096)));
+
+/** @brief Tabla de páginas para la parte final del kernel que no completa
+ * una página grande */
+static page_table_entry pae_boot_table[PT_ENTRIES] 
+    __attribute__((aligned(4096)));
+
+/** @brief Rutina definida en start.S que desactiva la paginación de 32 bits
+ * y activa la paginación PAE con la tabla de apuntadores a directorios
+ * indicada. */
+extern void enable_pae_paging(unsigned int pdpt_addr);
+
+/** @brief Retorna la dirección física de una variable del kernel */
+#define KERNEL_PHYS(ptr) ((unsigned int)(ptr) - KERNEL_VIRT_OFFSET)
+
+/**
+ * @brief Crea las tablas de paginación PAE equivalentes a las tablas de
+ * página iniciales creadas en start.S, y activa la paginación PAE.
+ * El primer MB, el kernel, los módulos y las tablas de página iniciales se
+ * mapean 1:1 y a partir de KERNEL_VIRT_OFFSET con páginas de 2 MB, y la
+ * parte final que no completa una página de 2 MB con una tabla de páginas.
+ * @param end Dirección física en la cual termina la memoria mapeada durante
+ * el arranque: las tablas de página iniciales y las reservas del asignador
+ * temprano (memblock_mapped_end)
+ * @return Número de entradas del directorio que mapean la memoria 1:1
+ */
+static int setup_pae(unsigned int end) {
+    int i;
+    int large_pages;
+    int entries;
+    int high_entry;
+    unsigned int addr;
+    unsigned int flags;
+
+    for (i = 0; i < PD_ENTRIES; i++) {
+        pae_directories[i] = PG_UNUSED;
+    }
+
+    large_pages = end / PAE_LARGE_PAGE_SIZE;
+    entries = large_pages;
+    high_entry = KERNEL_VIRT_OFFSET / PT_COVERAGE;
+
+    /* Mapear las páginas grandes completas */
+    for (i = 0; i < large_pages; i++) {
+        pae_directories[i] = (i * PAE_LARGE_PAGE_SIZE) 
+            | PG_LARGE | PG_KERNEL_PRESENT;
+        pae_directories[high_entry + i] = pae_directories[i];
+    }
+
+    /* Mapear la parte restante con una tabla de páginas */
+    if (end % PAE_LARGE_PAGE_SIZE != 0) {
+        addr = large_pages * PAE_LARGE_PAGE_SIZE;
+        for (i = 0; i < PT_ENTRIES; i++, addr += PAGE_SIZE) {
+            if (addr < end) {
+                pae_boot_table[i] = addr | PG_KERNEL_PRESENT;
+            }else {
+                pae_boot_table[i] = PG_UNUSED;
+            }
+        }
+        pae_directories[large_pages] = 
+            KERNEL_PHYS(pae_boot_table) | PG_KERNEL_PRESENT;
+        pae_directories[high_entry + large_pages] = 
+            pae_directories[large_pages];
+        entries++;
+    }
+
+    /* Mapeo recursivo: las últimas cuatro entradas apuntan a los cuatro
+     * directorios, que así se acceden en KERNEL_PD_VADDR y las tablas de
+     * página en KERNEL_PAGETABLES_VADDR */
+    for (i = 0; i < PDPT_ENTRIES; i++) {
+        pae_directories[PD_ENTRIES - PDPT_ENTRIES + i] = 
+            KERNEL_PHYS(&pae_directories[i * PT_ENTRIES]) | PG_KERNEL_PRESENT;
+        /* Las entradas de la PDPT solo usan el bit P */
+        pae_pdpt[i] = KERNEL_PHYS(&pae_directories[i * PT_ENTRIES]) 
+            | PG_PRESENT;
+    }
+
+    flags = disable_interrupts();
+    enable_pae_paging(KERNEL_PHYS(pae_pdpt));
+    kernel_pd_addr = KERNEL_PHYS(pae_pdpt);
+    restore_interrupts(flags);
+
+    return entries;
+}
+
+#endif
+
+unsigned int create_new_page_table(int pd_entry);
+static int map_frame_flags(unsigned int vaddr, unsigned int frame,
+        unsigned int flags);
+
+/**
+ * @brief Libera el marco de una página que se quita del espacio virtual.
+ * El marco de ceros compartido nunca se libera.
+ * @param frame Número del marco
+ */
+static __inline__ void release_frame(unsigned int frame) {
+    if (frame != kernel_zero_frame / PAGE_SIZE) {
+        free_frame_number(frame);
+    }
+}
+
+/**
+ * @brief Establece bits en el registro CR4.
+ * @param bits Bits a establecer (CR4_PSE, CR4_PGE)
+ */
+static __inline__ void set_cr4_bits(unsigned int bits) {
+    unsigned int cr4;
+
+    inline_assembly("movl %%cr4, %0" : "=r" (cr4));
+    inline_assembly("movl %0, %%cr4" : : "r" (cr4 | bits) : "memory");
+}
+
+/**
+ * @brief Establece bits en el registro CR0.
+ * @param bits Bits a establecer (CR0_WP)
+ */
+static __inline__ void set_cr0_bits(unsigned int bits) {
+    unsigned int cr0;
+
+    inline_assembly("movl %%cr0, %0" : "=r" (cr0));
+    inline_assembly("movl %0, %%cr0" : : "r" (cr0 | bits) : "memory");
+}
+
+/**
+ * @brief Obtiene el bit G que corresponde a una página: solo las páginas
+ * del kernel, sin incluir las tablas de página mapeadas de forma recursiva,
+ * son globales.
+ * @param vaddr Dirección virtual de la página
+ * @return PG_GLOBAL si el procesador soporta PGE y la página es del kernel
+ */
+static __inline__ unsigned int page_global(unsigned int vaddr) {
+    if (vaddr >= KERNEL_VIRT_OFFSET && vaddr < KERNEL_PAGETABLES_VADDR) {
+        return global_flag;
+    }
+    return 0;
+}
+
+/**
+ * @brief Cuenta las entradas presentes de las tablas de página existentes
+ * (las creadas al arrancar el kernel), y marca como globales las que
+ * pertenecen al espacio del kernel. Las tablas creadas después mantienen
+ * su conteo en map_page_frame, unmap_page y destroy_page.
+ */
+static void count_page_table_entries(void) {
+    int i;
+    int j;
+    page_table pt;
+
+    /* Las últimas entradas del directorio corresponden al mapeo recursivo */
+    for (i = 0; i < KERNEL_PAGETABLES_VADDR / PT_COVERAGE; i++) {
+        page_table_used[i] = 0;
+        if (!(kernel_pd[i] & PG_PRESENT)) {
+            continue;
+        }
+        if (kernel_pd[i] & PG_LARGE) {
+            kernel_pd[i] |= page_global(i * PT_COVERAGE);
+            continue;
+        }
+        pt = (page_table)(KERNEL_PAGETABLES_VADDR + (i * PAGE_SIZE));
+        for (j = 0; j < PT_ENTRIES; j++) {
+            if (pt[j] & PG_PRESENT) {
+                pt[j] |= page_global(i * PT_COVERAGE);
+                page_table_used[i]++;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Libera una tabla de páginas que no tiene entradas presentes, y
+ * marca la entrada correspondiente en el directorio como no usada.
+ * @param pd_entry Entrada del directorio
+ */
+static void release_page_table(int pd_entry) {
+    unsigned int pt_frame;
+
+#ifdef PAGING_PREALLOCATE_TABLES
+    /* Las tablas de página del espacio del kernel nunca se liberan */
+    if (pd_entry >= KERNEL_VIRT_OFFSET / PT_COVERAGE) {
+        return;
+    }
+#endif
+
+    /* Obtener la dirección del marco de página en el cual se encuentra la
+     * tabla de páginas */
+    pt_frame = kernel_pd[pd_entry] & PG_FRAME_MASK;
+
+    //console_printf("Invalidate page table %d => 0x%x\n", pd_entry, pt_frame);
+
+    /* Invalidar la página en el TLB */
+    invalidate_page(KERNEL_PAGETABLES_VADDR + (pd_entry * PAGE_SIZE));
+
+    /* Marcar la entrada en el directorio como no usada */
+    kernel_pd[pd_entry] = PG_UNUSED;
+
+    /* Liberar el marco de página que tenía asignada la tabla */
+    free_frame(pt_frame);
+}
+
+/**
+ * @brief Llena de ceros una página usando escrituras no temporales, que no
+ * desplazan datos útiles de la memoria cache del procesador.
+ * @param vaddr Dirección virtual de la página
+ */
+static void zero_page_nt(unsigned int vaddr) {
+    int count;
+
+    count = PAGE_SIZE / 16;
+
+    inline_assembly("xorl %%eax, %%eax\n\t" \
+                "1:\n\t" \
+                "movnti %%eax, (%0)\n\t" \
+                "movnti %%eax, 4(%0)\n\t" \
+                "movnti %%eax, 8(%0)\n\t" \
+                "movnti %%eax, 12(%0)\n\t" \
+                "addl $16, %0\n\t" \
+                "decl %1\n\t" \
+                "jnz 1b\n\t" \
+                "sfence" \
+                : "+r" (vaddr), "+r" (count) \
+                : \
+                : "eax", "memory", "cc");
+}
+
+/**
+ * @brief Llena de ceros una página.
+ * @param vaddr Dirección virtual de la página
+ */
+static void zero_page(unsigned int vaddr) {
+    int count;
+
+    if (zero_nt_supported) {
+        zero_page_nt(vaddr);
+        return;
+    }
+
+    count = PAGE_SIZE / 4;
+
+    inline_assembly("cld\n\t" \
+                "rep stosl" \
+                : "+D" (vaddr), "+c" (count) \
+                : "a" (0) \
+                : "memory", "cc");
+}
+
+/**
+ * @brief Retorna las ranuras de mapeo temporal del procesador actual.
+ */
+static __inline__ kmap_slots * current_kmap_slots(void) {
+    return &kernel_kmap_slots;
+}
+
+/**
+ * @brief Mapea temporalmente un marco de página.
+ */
+unsigned int kmap_frame(unsigned int frame) {
+    kmap_slots * slots;
+    page_table pt;
+    unsigned int vaddr;
+    unsigned int flags;
+
+    /* Los marcos del mapa directo no requieren un mapeo temporal */
+    if (frame < PHYSMEM_HIGH_START_FRAME 
+            && physmap_contains(frame * PAGE_SIZE)) {
+        return phys_to_virt(frame * PAGE_SIZE);
+    }
+
+    flags = disable_interrupts();
+    slots = current_kmap_slots();
+    if (slots->used == KMAP_SLOTS) {
+        restore_interrupts(flags);
+        return 0;
+    }
+    vaddr = slots->base + (slots->used * PAGE_SIZE);
+    slots->used++;
+    restore_interrupts(flags);
+
+    /* La ranura no se encontraba mapeada, no existe una entrada en el TLB */
+    pt = (page_table)(KERNEL_PAGETABLES_VADDR 
+            + ((vaddr / PT_COVERAGE) * PAGE_SIZE));
+    pt[(vaddr / PAGE_SIZE) % PT_ENTRIES] = 
+        ((page_table_entry)frame << 12) | PG_KERNEL_PRESENT;
+
+    return vaddr;
+}
+
+/**
+ * @brief Quita el mapeo temporal de un marco.
+ */
+void kunmap_frame(unsigned int vaddr) {
+    kmap_slots * slots;
+    page_table pt;
+    unsigned int flags;
+
+    slots = current_kmap_slots();
+
+    /* Las direcciones del mapa directo no usan una ranura */
+    if (vaddr < slots->base || vaddr >= slots->base + KMAP_SLOTS * PAGE_SIZE) {
+        return;
+    }
+
+    vaddr = vaddr & ~(PAGE_SIZE - 1);
+    pt = (page_table)(KERNEL_PAGETABLES_VADDR 
+            + ((vaddr / PT_COVERAGE) * PAGE_SIZE));
+    pt[(vaddr / PAGE_SIZE) % PT_ENTRIES] = PG_UNUSED;
+    inline_assembly("invlpg (%0)" : : "r" (vaddr) : "memory");
+
+    flags = disable_interrupts();
+    if (slots->used > 0) {
+        slots->used--;
+    }
+    restore_interrupts(flags);
+}
+
+/**
+ * @brief Llena de ceros un marco de página, mapeándolo temporalmente con
+ * kmap_frame.
+ * @param frame Dirección física del marco
+ * @return 1 si exitoso, 0 si no existen ranuras de mapeo temporal libres
+ */
+static int zero_frame(unsigned int frame) {
+    unsigned int vaddr;
+
+    vaddr = kmap_frame(frame / PAGE_SIZE);
+    if (!vaddr) {
+        return 0;
+    }
+    zero_page(vaddr);
+    kunmap_frame(vaddr);
+    return 1;
+}
+
+/**
+ * @brief Toma un marco de la lista de marcos llenos de ceros.
+ * @return Dirección física del marco, 0 si la lista está vacía
+ */
+static unsigned int take_zeroed_frame(void) {
+    unsigned int frame;
+    unsigned int flags;
+
+    frame = 0;
+    flags = disable_interrupts();
+    if (zeroed_frames_count > 0) {
+        frame = zeroed_frames[--zeroed_frames_count];
+    }
+    restore_interrupts(flags);
+
+    return frame;
+}
+
+/**
+ * @brief Mapea una región física en el mapa directo. Los bloques de
+ * PT_COVERAGE bytes que se encuentran completos dentro de la región se
+ * mapean con páginas grandes si es posible.
+ * @param addr Inicio de la región, alineado a PAGE_SIZE
+ * @param end Fin de la región, alineado a PAGE_SIZE
+ * @return Dirección física en la cual termina la parte mapeada
+ */
+static unsigned int physmap_map_range(unsigned int addr, unsigned int end) {
+    unsigned int block_end;
+    int pd_entry;
+
+    while (addr < end) {
+        block_end = (addr & ~(PT_COVERAGE - 1)) + PT_COVERAGE;
+        pd_entry = phys_to_virt(addr) / PT_COVERAGE;
+
+        /* El bloque ya se encuentra mapeado con una página grande (el
+         * kernel, si start.S usó páginas de 4 MB) */
+        if (kernel_pd[pd_entry] & PG_LARGE) {
+            addr = block_end;
+            continue;
+        }
+
+        if (addr % PT_COVERAGE == 0 && block_end <= end 
+                && map_large_page(phys_to_virt(addr), addr)) {
+            addr = block_end;
+            continue;
+        }
+
+        if (block_end > end) {
+            block_end = end;
+        }
+
+        /* map_page no modifica las páginas que ya se encuentran
+         * mapeadas, como las del kernel */
+        for (; addr < block_end; addr += PAGE_SIZE) {
+            if (!map_page(phys_to_virt(addr), addr)
+                    && !(kernel_pd[pd_entry] & PG_PRESENT)) {
+                /* No existen marcos para crear la tabla de páginas */
+                return addr;
+            }
+        }
+    }
+    return end;
+}
+
+/**
+ * @brief Mapea la memoria física utilizable que se encuentra por debajo de
+ * PHYSMAP_SIZE a partir de PHYSMAP_VADDR, y la memoria reservada con el
+ * asignador temprano (memblock.h), que contiene el arreglo de descriptores
+ * de marco.
+ */
+static void setup_physmap(void) {
+    int i;
+    unsigned int addr;
+    unsigned int end;
+
+    physmap_end = 0;
+
+    /* Las reservas del asignador temprano se excluyen de las regiones
+     * utilizables */
+    for (i = 0; i < memblock_region_count; i++) {
+        addr = memblock_regions[i].start;
+        end = addr + memblock_regions[i].length;
+        if (end <= PHYSMAP_SIZE && physmap_map_range(addr, end) < end) {
+            /* Los descriptores de marco pueden no estar mapeados */
+            frame_desc_range.length = 0;
+        }
+    }
+
+    /* Las regiones se encuentran ordenadas por dirección */
+    for (i = 0; i < physmem_range_count; i++) {
+        addr = physmem_ranges[i].start;
+        if (addr >= PHYSMAP_SIZE) {
+            break;
+        }
+        end = addr + physmem_ranges[i].length;
+        if (end > PHYSMAP_SIZE || end < addr) {
+            end = PHYSMAP_SIZE;
+        }
+
+        physmap_end = physmap_map_range(addr, end);
+        if (physmap_end < end) {
+            return;
+        }
+    }
+}
+
 /**
  * @brief Completa el proceso de configurar la paginación para el kernel.
  */
@@ -27,10 +524,22 @@ void setup_paging() {
     int i;
     unsigned int new_frame;
 
+#ifdef PAGING_PAE
+    /* Activar la paginación PAE, y acceder a los directorios de tablas de
+     * página mediante el mapeo recursivo */
+    i = setup_pae(memblock_mapped_end);
+    kernel_pd = (page_directory)(KERNEL_PD_VADDR);
+
+    /* Eliminar el mapeo 1:1 del primer MB y el kernel, e invalidar el TLB */
+    while (i > 0) {
+        i--;
+        kernel_pd[i] = PG_UNUSED;
+    }
+    flush_tlb();
+#else
     extern unsigned int kernel_initial_pagetables_end;
     extern unsigned int kernel_page_tables;
 
-
     /* Usar la dirección virtual del directorio de tablas de página */
     kernel_pd = (unsigned int *)(kernel_pd_addr + KERNEL_VIRT_OFFSET);
 
@@ -72,6 +581,31 @@ void setup_paging() {
     for (i = 0; i< kernel_initial_pagetables_end; i = i + PAGE_SIZE) {
         invalidate_page(i);
     }
+#endif
+
+#ifdef PAGING_PAE
+    /* En modo PAE los directorios siempre admiten páginas de 2 MB */
+    large_pages_enabled = 1;
+#else
+    /* Activar las páginas de 4 MB si el procesador las soporta */
+    large_pages_enabled = (cpu_features() & CPUID_FEAT_EDX_PSE) != 0;
+    if (large_pages_enabled) {
+        set_cr4_bits(CR4_PSE);
+    }
+#endif
+
+    /* Las páginas globales del kernel se conservan en el TLB al recargar
+     * CR3 */
+    global_flag = 0;
+    if (cpu_features() & CPUID_FEAT_EDX_PGE) {
+        set_cr4_bits(CR4_PGE);
+        global_flag = PG_GLOBAL;
+    }
+
+    /* Contar las entradas usadas de las tablas de página iniciales, y
+     * marcar las páginas del kernel como globales */
+    count_page_table_entries();
+    flush_tlb();
 
     /* A partir de este momento cualquier referencia a una página no mapeada
      * generará una excepción de generará un fallo de página, y se
@@ -79,6 +613,94 @@ void setup_paging() {
 
     /* Instalar el manejador de excepción de fallo de página */
     install_exception_handler(PAGE_FAULT_EXCEPTION, page_fault_handler);
+
+    /* Crear la tabla de páginas de KERNEL_SCRATCH_VADDR, que contiene las
+     * ranuras de kmap_frame */
+    zeroed_frames_count = 0;
+    kernel_kmap_slots.base = KERNEL_SCRATCH_VADDR;
+    kernel_kmap_slots.used = 0;
+    setup_physmap();
+    zero_nt_supported = (cpu_features() & CPUID_FEAT_EDX_SSE2) != 0;
+    if (!(kernel_pd[KERNEL_SCRATCH_VADDR / PT_COVERAGE] 
+                & PG_PRESENT)) {
+        create_new_page_table(KERNEL_SCRATCH_VADDR / PT_COVERAGE);
+    }
+
+    /* Las páginas de solo lectura también se protegen de las escrituras del
+     * kernel, para poder compartir el marco de ceros */
+    set_cr0_bits(CR0_WP);
+    kernel_zero_frame = allocate_zeroed_frame();
+
+#ifdef PAGING_PREALLOCATE_TABLES
+    /* Crear todas las tablas de página del espacio del kernel, excepto las
+     * entradas del mapeo recursivo. Las entradas del directorio del kernel
+     * ya no cambian, y mapear una página no requiere reservar memoria. */
+    for (i = KERNEL_VIRT_OFFSET / PT_COVERAGE; 
+            i < KERNEL_PAGETABLES_VADDR / PT_COVERAGE; i++) {
+        if (!(kernel_pd[i] & PG_PRESENT)) {
+            create_new_page_table(i);
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Reserva un marco de página lleno de ceros.
+ */
+unsigned int allocate_zeroed_frame(void) {
+    unsigned int frame;
+    unsigned int flags;
+
+    frame = take_zeroed_frame();
+    if (frame) {
+        return frame;
+    }
+
+    /* No hay marcos disponibles, llenar uno de ceros en este momento */
+    flags = disable_interrupts();
+    frame = allocate_frame();
+    if (frame && !zero_frame(frame)) {
+        free_frame(frame);
+        frame = 0;
+    }
+    restore_interrupts(flags);
+
+    return frame;
+}
+
+/**
+ * @brief Llena de ceros marcos libres hasta completar ZEROED_FRAMES_MAX.
+ */
+int refill_zeroed_frames(void) {
+    unsigned int frame;
+    unsigned int flags;
+    int count;
+
+    count = 0;
+
+    /* No retener marcos si la memoria disponible es escasa */
+    while (zeroed_frames_count < ZEROED_FRAMES_MAX &&
+            available_frames() > ZEROED_FRAMES_MAX) {
+        /* Llenar un marco a la vez, para no mantener deshabilitadas las
+         * interrupciones por mucho tiempo */
+        flags = disable_interrupts();
+        frame = allocate_frame();
+        if (frame && !zero_frame(frame)) {
+            free_frame(frame);
+            frame = 0;
+        }
+        if (frame) {
+            zeroed_frames[zeroed_frames_count++] = frame;
+            count++;
+        }
+        restore_interrupts(flags);
+
+        if (!frame) {
+            break;
+        }
+    }
+
+    return count;
 }
 
 /**
@@ -91,6 +713,15 @@ unsigned int create_new_page_table(int pd_entry) {
     int i;
     page_table pt;
 
+    /* Si existe un marco lleno de ceros, no es necesario inicializar las
+     * entradas de la tabla: una entrada en cero no está presente */
+    frame_addr = take_zeroed_frame();
+    if (frame_addr) {
+        page_table_used[pd_entry] = 0;
+        kernel_pd[pd_entry] = frame_addr | PG_KERNEL_PRESENT;
+        return frame_addr;
+    }
+
     /* Obtener un marco de página */
     frame_addr = allocate_frame();
 
@@ -104,6 +735,7 @@ unsigned int create_new_page_table(int pd_entry) {
     /* Marcar la entrada del directorio como válida, con lo cual automáticamente
      * se tiene acceso a la tabla de páginas en el espacio virtual a partir de
      * KERNEL_PAGETABLES_VADDR */
+    page_table_used[pd_entry] = 0;
     kernel_pd[pd_entry] = frame_addr | PG_KERNEL_PRESENT;
 
     //console_printf("Entry: %d Page table at: 0x%x\n", pd_entry, (unsigned int)pt);
@@ -123,6 +755,82 @@ unsigned int create_new_page_table(int pd_entry) {
  * Retorna 1 si se mapeó correctamente 0, en caso de error
  */
 int map_page(unsigned int vaddr, unsigned int addr) {
+    return map_page_frame(vaddr, addr / PAGE_SIZE);
+}
+
+/**
+ * @brief Permite mapear una página a un marco de página, indicado por su
+ * número.
+ * Retorna 1 si se mapeó correctamente 0, en caso de error
+ */
+int map_page_frame(unsigned int vaddr, unsigned int frame) {
+    return map_frame_flags(vaddr, frame, PG_KERNEL_PRESENT);
+}
+
+/**
+ * @brief Mapea el marco de ceros compartido en una página, de solo lectura.
+ */
+int map_zero_page(unsigned int vaddr) {
+    if (!kernel_zero_frame) {
+        return 0;
+    }
+    return map_frame_flags(vaddr, kernel_zero_frame / PAGE_SIZE, PG_PRESENT);
+}
+
+/**
+ * @brief Reemplaza el marco de ceros compartido de una página por un marco
+ * propio lleno de ceros, con permisos de escritura (copia en escritura).
+ * @param vaddr Dirección en la cual ocurrió una escritura
+ * @return 1 si la página tenía el marco de ceros y se reemplazó, 0 en caso
+ * contrario
+ */
+static int copy_zero_page(unsigned int vaddr) {
+    int pd_entry;
+    int pt_entry;
+    unsigned int frame;
+    page_table pt;
+
+    if (!kernel_zero_frame || vaddr >= KERNEL_PAGETABLES_VADDR) {
+        return 0;
+    }
+
+    pd_entry = vaddr / PT_COVERAGE;
+    pt_entry = (vaddr % PT_COVERAGE) / PAGE_SIZE;
+
+    if (!(kernel_pd[pd_entry] & PG_PRESENT) 
+            || (kernel_pd[pd_entry] & PG_LARGE)) {
+        return 0;
+    }
+
+    pt = (page_table)((KERNEL_PAGETABLES_VADDR) + (pd_entry * PAGE_SIZE));
+    if (!(pt[pt_entry] & PG_PRESENT) 
+            || PG_FRAME_NUMBER(pt[pt_entry]) != kernel_zero_frame / PAGE_SIZE) {
+        return 0;
+    }
+
+    frame = allocate_zeroed_frame();
+    if (!frame) {
+        return 0;
+    }
+
+    /* La entrada sigue presente, solo cambia el marco y los permisos */
+    pt[pt_entry] = (page_table_entry)frame | PG_KERNEL_PRESENT 
+        | page_global(vaddr);
+    inline_assembly("invlpg (%0)" : : "r" (vaddr & ~(PAGE_SIZE - 1)) 
+            : "memory");
+
+    return 1;
+}
+
+/**
+ * @brief Mapea una página a un marco con los bits indicados.
+ * @param vaddr Dirección virtual de la página
+ * @param frame Número del marco
+ * @param flags Bits de la entrada (PG_KERNEL_PRESENT, PG_PRESENT)
+ * @return 1 si se mapeó correctamente, 0 en caso de error
+ */
+static int map_frame_flags(unsigned int vaddr, unsigned int frame,
+        unsigned int flags) {
     int pd_entry;
     int pt_entry;
     unsigned int new_addr;
@@ -140,8 +848,8 @@ int map_page(unsigned int vaddr, unsigned int addr) {
     }
 
     /* Obtener la entrada en el directorio y en la tabla de páginas */
-    pd_entry = vaddr / (PAGE_SIZE * PD_ENTRIES);
-    pt_entry = (vaddr % (PAGE_SIZE * PD_ENTRIES)) / PAGE_SIZE;
+    pd_entry = vaddr / PT_COVERAGE;
+    pt_entry = (vaddr % PT_COVERAGE) / PAGE_SIZE;
 
     //console_printf("PD entry: %d PT entry: %d\n", pd_entry, pt_entry);
 
@@ -155,6 +863,11 @@ int map_page(unsigned int vaddr, unsigned int addr) {
         }
     }
 
+    /* La página se encuentra dentro de una página grande */
+    if (kernel_pd[pd_entry] & PG_LARGE) {
+        return 0;
+    }
+
     /* Ubicar la tabla de páginas correspondiente y marcar la entrada como 
      * usada */
     pt = (page_table)((KERNEL_PAGETABLES_VADDR) + (pd_entry * PAGE_SIZE));
@@ -166,20 +879,80 @@ int map_page(unsigned int vaddr, unsigned int addr) {
 
     /* Actualizar la entrada en la tabla de páginas con la dirección física
      * correspondiente. */
-    pt[pt_entry] = addr | PG_KERNEL_PRESENT;
+    pt[pt_entry] = ((page_table_entry)frame << 12) | flags
+        | page_global(vaddr);
+    page_table_used[pd_entry]++;
 
     return 1;
 }
 
+/**
+ * @brief Indica si se pueden mapear páginas grandes.
+ */
+int large_pages_supported(void) {
+    return large_pages_enabled;
+}
+
+/**
+ * @brief Mapea una página grande directamente en el directorio de tablas de
+ * página.
+ */
+int map_large_page(unsigned int vaddr, unsigned int addr) {
+    int pd_entry;
+
+    if (!large_pages_enabled
+            || (vaddr % PT_COVERAGE) != 0
+            || (addr % PT_COVERAGE) != 0
+            || vaddr >= KERNEL_PAGETABLES_VADDR) {
+        return 0;
+    }
+
+    pd_entry = vaddr / PT_COVERAGE;
+
+    /* La entrada no debe tener una tabla de páginas ni otra página grande */
+    if (kernel_pd[pd_entry] & PG_PRESENT) {
+        return 0;
+    }
+
+    kernel_pd[pd_entry] = (page_directory_entry)addr 
+        | PG_LARGE | PG_KERNEL_PRESENT | page_global(vaddr);
+
+    return 1;
+}
+
+/**
+ * @brief Quita una página grande del espacio virtual.
+ */
+unsigned int unmap_large_page(unsigned int vaddr) {
+    int pd_entry;
+    page_directory_entry entry;
+
+    if (vaddr >= KERNEL_PAGETABLES_VADDR) {
+        return 0;
+    }
+
+    pd_entry = vaddr / PT_COVERAGE;
+    entry = kernel_pd[pd_entry];
+
+    if (!(entry & PG_PRESENT) || !(entry & PG_LARGE)) {
+        return 0;
+    }
+
+    kernel_pd[pd_entry] = PG_UNUSED;
+
+    /* Una sola entrada del TLB cubre toda la página grande */
+    invalidate_page(vaddr);
+
+    return (unsigned int)(entry & PG_FRAME_MASK);
+}
+
 /**
  * @brief Permite quitar una página del espacio virtual
  */
 int unmap_page(unsigned int vaddr) {
     int pd_entry;
     int pt_entry;
-    int i;
     page_table pt;
-    unsigned int pt_frame;
 
     /* Redondear la dirección virtual a un límite de página */
     vaddr = ROUND_DOWN_TO_PAGE(vaddr);
@@ -193,13 +966,15 @@ int unmap_page(unsigned int vaddr) {
     }
 
     /* Obtener la entrada en el directorio y en la tabla de páginas */
-    pd_entry = vaddr / (PAGE_SIZE * PD_ENTRIES);
-    pt_entry = (vaddr % (PAGE_SIZE * PD_ENTRIES)) / PAGE_SIZE;
+    pd_entry = vaddr / PT_COVERAGE;
+    pt_entry = (vaddr % PT_COVERAGE) / PAGE_SIZE;
 
     //console_printf("PD entry: %d PT entry: %d\n", pd_entry, pt_entry);
 
-    /* No se puede quitar el mapeo de una tabla que no está presente. */
-    if (! (kernel_pd[pd_entry] & PG_PRESENT)) {
+    /* No se puede quitar el mapeo de una tabla que no está presente, ni
+     * de una página grande. */
+    if (! (kernel_pd[pd_entry] & PG_PRESENT) 
+            || (kernel_pd[pd_entry] & PG_LARGE)) {
         //console_printf("Warning! PD entry %d not present!\n", pd_entry);
         return 0;
     }
@@ -209,37 +984,17 @@ int unmap_page(unsigned int vaddr) {
     pt = (page_table)((KERNEL_PAGETABLES_VADDR) + (pd_entry * PAGE_SIZE));
     if (pt[pt_entry] & PG_PRESENT) {
         pt[pt_entry] = PG_UNUSED;
+        page_table_used[pd_entry]--;
     }
 
     /* Invalidar la página en el TLB */
     invalidate_page(vaddr);
 
-    /* Recorrer la tabla de páginas para verificar si está usando alguna entrada
-     * */
-    i = 0;
-    while (i < PT_ENTRIES && !(pt[i] & PG_PRESENT)){
-        i++;
-    }
-    //console_printf("Page table empty entries: %d\n", i);
-
     /* Si ninguna entrada de la tabla está siendo usada, se puede liberar la
      * página de memoria que contiene la tabla de páginas y marcar la entrada
      * correspondiente en el directorio como no usada. */
-    if (i == 1024) {
-        /* Obtener la dirección del marco de página en el cual se encuentra la
-         * tabla de páginas */
-        pt_frame = kernel_pd[pd_entry] & 0xFFFFF000;
-
-        //console_printf("Invalidate page 0x%x => 0x%x\n", (unsigned int)pt, pt_frame);
-        
-        /* Invalidar la página en el TLB */
-        invalidate_page((unsigned int)pt);
-
-        /* Marcar la entrada en el directorio como no usada */
-        kernel_pd[pd_entry] = PG_UNUSED;
-
-        /* Liberar el marco de página que tenía asignada la tabla */
-        free_frame(pt_frame);
+    if (page_table_used[pd_entry] == 0) {
+        release_page_table(pd_entry);
     }
     return 1;
 }
@@ -250,10 +1005,8 @@ int unmap_page(unsigned int vaddr) {
 int destroy_page(unsigned int vaddr) {
     int pd_entry;
     int pt_entry;
-    int i;
     page_table pt;
     unsigned int frame;
-    unsigned int pt_frame;
 
     /* Redondear la dirección virtual a un límite de página */
     vaddr = ROUND_DOWN_TO_PAGE(vaddr);
@@ -267,13 +1020,15 @@ int destroy_page(unsigned int vaddr) {
     }
 
     /* Obtener la entrada en el directorio y en la tabla de páginas */
-    pd_entry = vaddr / (PAGE_SIZE * PD_ENTRIES);
-    pt_entry = (vaddr % (PAGE_SIZE * PD_ENTRIES)) / PAGE_SIZE;
+    pd_entry = vaddr / PT_COVERAGE;
+    pt_entry = (vaddr % PT_COVERAGE) / PAGE_SIZE;
 
     //console_printf("\nVaddr: 0x%x PD entry: %d PT entry: %d\n", vaddr, pd_entry, pt_entry);
 
-    /* No se puede quitar el mapeo de una tabla que no está presente. */
-    if (! (kernel_pd[pd_entry] & PG_PRESENT)) {
+    /* No se puede quitar el mapeo de una tabla que no está presente, ni
+     * de una página grande. */
+    if (! (kernel_pd[pd_entry] & PG_PRESENT) 
+            || (kernel_pd[pd_entry] & PG_LARGE)) {
         //console_printf("Warning! PD entry %d not present!\n", pd_entry);
         return 0;
     }
@@ -282,46 +1037,191 @@ int destroy_page(unsigned int vaddr) {
      * usada */
     pt = (page_table)((KERNEL_PAGETABLES_VADDR) + (pd_entry * PAGE_SIZE));
     if (pt[pt_entry] & PG_PRESENT) {
-        frame = pt[pt_entry] & 0xFFFFF000;
+        frame = PG_FRAME_NUMBER(pt[pt_entry]);
         //Libera el marco de pagina de la memoria fisica
-        free_frame(frame);
+        release_frame(frame);
         pt[pt_entry] = PG_UNUSED;
+        page_table_used[pd_entry]--;
     }
 
     /* Invalidar la página en el TLB */
     invalidate_page(vaddr);
 
-    /* Recorrer la tabla de páginas para verificar si está usando alguna entrada
-     * */
-    i = 0;
-    while (i < PT_ENTRIES && !(pt[i] & PG_PRESENT)){
-        i++;
-    }
-
-    //console_printf("Page table empty entries: %d\n", i);
-
     /* Si ninguna entrada de la tabla está siendo usada, se puede liberar la
      * página de memoria que contiene la tabla de páginas y marcar la entrada
      * correspondiente en el directorio como no usada. */
-    if (i == 1024) {
-        /* Obtener la dirección del marco de página en el cual se encuentra la
-         * tabla de páginas */
-        pt_frame = kernel_pd[pd_entry] & 0xFFFFF000;
+    if (page_table_used[pd_entry] == 0) {
+        release_page_table(pd_entry);
+    }
+    return 1;
+}
+
+/**
+ * @brief Invalida todas las entradas del TLB, incluyendo las páginas
+ * globales: al desactivar y activar de nuevo PGE en CR4 se invalidan
+ * todas las entradas.
+ */
+static void flush_tlb_global(void) {
+    unsigned int cr4;
+
+    if (!global_flag) {
+        flush_tlb();
+        return;
+    }
+
+    inline_assembly("movl %%cr4, %0" : "=r" (cr4));
+    inline_assembly("movl %0, %%cr4" : : "r" (cr4 & ~CR4_PGE) : "memory");
+    inline_assembly("movl %0, %%cr4" : : "r" (cr4) : "memory");
+}
+
+/**
+ * @brief Invalida en el TLB las entradas de un rango de páginas. Si el
+ * rango supera TLB_FLUSH_THRESHOLD páginas, se invalida todo el TLB.
+ * @param vaddr Dirección de la primera página
+ * @param count Número de páginas
+ */
+static void flush_range(unsigned int vaddr, int count) {
+    if (count > TLB_FLUSH_THRESHOLD) {
+        flush_tlb_global();
+        return;
+    }
+    for (; count > 0; count--, vaddr += PAGE_SIZE) {
+        inline_assembly("invlpg (%0)" : : "r" (vaddr) : "memory");
+    }
+}
+
+/**
+ * @brief Quita el mapeo de un rango de páginas, recorriendo las entradas
+ * consecutivas de cada tabla de páginas, e invalida el TLB una sola vez.
+ * @param vaddr Dirección de la primera página, alineada a PAGE_SIZE
+ * @param count Número de páginas
+ * @param release 1 para liberar los marcos asociados
+ * @return 1 en caso de éxito, 0 si el rango no es válido
+ */
+static int clear_range(unsigned int vaddr, int count, int release) {
+    int pd_entry;
+    int pt_entry;
+    int i;
+    int j;
+    int n;
+    unsigned int start;
+    page_table pt;
+
+    if (count <= 0 || vaddr >= KERNEL_PAGETABLES_VADDR
+            || count > (KERNEL_PAGETABLES_VADDR - vaddr) / PAGE_SIZE) {
+        return 0;
+    }
+
+    start = vaddr;
+    for (i = count; i > 0; i -= n, vaddr += n * PAGE_SIZE) {
+        pd_entry = vaddr / PT_COVERAGE;
+        pt_entry = (vaddr % PT_COVERAGE) / PAGE_SIZE;
+
+        /* Páginas del rango que se encuentran en esta tabla */
+        n = PT_ENTRIES - pt_entry;
+        if (n > i) {
+            n = i;
+        }
 
-        //console_printf("Invalidate page table %d => 0x%x\n", pd_entry, pt_frame);
-        
-        /* Invalidar la página en el TLB */
-        invalidate_page((unsigned int)pt);
+        if (!(kernel_pd[pd_entry] & PG_PRESENT) 
+                || (kernel_pd[pd_entry] & PG_LARGE)) {
+            continue;
+        }
 
-        /* Marcar la entrada en el directorio como no usada */
-        kernel_pd[pd_entry] = PG_UNUSED;
+        pt = (page_table)((KERNEL_PAGETABLES_VADDR) + (pd_entry * PAGE_SIZE));
+        for (j = pt_entry; j < pt_entry + n; j++) {
+            if (pt[j] & PG_PRESENT) {
+                if (release) {
+                    release_frame(PG_FRAME_NUMBER(pt[j]));
+                }
+                pt[j] = PG_UNUSED;
+                page_table_used[pd_entry]--;
+            }
+        }
 
-        /* Liberar el marco de página que tenía asignada la tabla */
-        free_frame(pt_frame);
+        if (page_table_used[pd_entry] == 0) {
+            release_page_table(pd_entry);
+        }
     }
+
+    flush_range(start, count);
+
     return 1;
 }
 
+/**
+ * @brief Mapea un rango de páginas a marcos contiguos.
+ */
+int map_range(unsigned int vaddr, unsigned int addr, int count,
+        unsigned int flags) {
+    int pd_entry;
+    int pt_entry;
+    int mapped;
+    int error;
+    page_table pt;
+
+    vaddr = vaddr & ~(PAGE_SIZE - 1);
+    addr = addr & ~(PAGE_SIZE - 1);
+
+    if (count <= 0 || vaddr >= KERNEL_PAGETABLES_VADDR
+            || count > (KERNEL_PAGETABLES_VADDR - vaddr) / PAGE_SIZE) {
+        return 0;
+    }
+
+    mapped = 0;
+    error = 0;
+    while (mapped < count && !error) {
+        pd_entry = vaddr / PT_COVERAGE;
+        pt_entry = (vaddr % PT_COVERAGE) / PAGE_SIZE;
+
+        if (!(kernel_pd[pd_entry] & PG_PRESENT)
+                && !create_new_page_table(pd_entry)) {
+            break;
+        }
+
+        if (kernel_pd[pd_entry] & PG_LARGE) {
+            break;
+        }
+
+        /* Escribir las entradas consecutivas de esta tabla */
+        pt = (page_table)((KERNEL_PAGETABLES_VADDR) + (pd_entry * PAGE_SIZE));
+        for (; pt_entry < PT_ENTRIES && mapped < count; 
+                pt_entry++, mapped++, vaddr += PAGE_SIZE, addr += PAGE_SIZE) {
+            if (pt[pt_entry] & PG_PRESENT) {
+                error = 1;
+                break;
+            }
+            pt[pt_entry] = (page_table_entry)addr | flags | page_global(vaddr);
+            page_table_used[pd_entry]++;
+        }
+    }
+
+    if (mapped < count) {
+        /* Deshacer el mapeo de las páginas anteriores */
+        if (mapped > 0) {
+            clear_range(vaddr - mapped * PAGE_SIZE, mapped, 0);
+        }
+        return 0;
+    }
+
+    /* Las entradas que no estaban presentes no se almacenan en el TLB */
+    return 1;
+}
+
+/**
+ * @brief Quita el mapeo de un rango de páginas.
+ */
+int unmap_range(unsigned int vaddr, int count) {
+    return clear_range(vaddr & ~(PAGE_SIZE - 1), count, 0);
+}
+
+/**
+ * @brief Quita el mapeo de un rango de páginas y libera sus marcos.
+ */
+int destroy_range(unsigned int vaddr, int count) {
+    return clear_range(vaddr & ~(PAGE_SIZE - 1), count, 1);
+}
+
 /**
  * @brief Imprime las entradas presentes de una tabla de páginas
  */
@@ -330,14 +1230,14 @@ void print_page_table(page_directory pd) {
 
     
     console_printf("Page table at 0x%x[0x%x]\n", (unsigned int)pd,
-            ROUND_DOWN_TO_PAGE((unsigned int)pd[1023]));
+            ROUND_DOWN_TO_PAGE((unsigned int)pd[PD_ENTRIES - 1]));
     
     
      /* Imprimir las entradas marcadas como válidas en el directorio de tablas
       * de  página */
     for (i = 0; i < PD_ENTRIES; i++) {
         if (pd[i] & PG_PRESENT) {
-            console_printf("PD[%d] = 0x%x\n", i, pd[i]);
+            console_printf("PD[%d] = 0x%x\n", i, (unsigned int)pd[i]);
         }
     }
 }
@@ -351,8 +1251,15 @@ unsigned int read_cr2() {
     return result;
 }
 
+/**
+ * @brief Instala la rutina que intenta resolver los fallos de página.
+ */
+void install_page_fault_resolver(page_fault_resolver resolver) {
+    fault_resolver = resolver;
+}
+
 /* @brief Rutina básica para manejar un fallo de página.
- * Bloquea el kernel si existe fallo de página. */
+ * Bloquea el kernel si el fallo no se puede resolver. */
 void page_fault_handler(interrupt_state * state) {
     unsigned int vaddr;
     unsigned int page;
@@ -365,6 +1272,18 @@ void page_fault_handler(interrupt_state * state) {
 
     vaddr = read_cr2();
 
+    /* Escritura en una página que comparte el marco de ceros */
+    if ((state->error_code & (PF_PRESENT | PF_WRITE)) 
+                == (PF_PRESENT | PF_WRITE) 
+            && copy_zero_page(vaddr)) {
+        return;
+    }
+
+    /* Intentar resolver el fallo (páginas reservadas bajo demanda) */
+    if (fault_resolver != 0 && fault_resolver(vaddr, state->error_code)) {
+        return;
+    }
+
     /* Calcular la página en la cual se encuentra la dirección, eliminando los
      * 12 bits menos significativos de ésta */
     page = vaddr & 0xFFFFF000;
@@ -0,0 +1,69 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Asignador temprano de memoria física (memblock). Detecta las
+ * regiones de memoria utilizables a partir del mapa de memoria de GRUB, y
+ * reserva memoria del inicio de ellas antes de que se inicialice el
+ * asignador de marcos, por ejemplo para sus mapas de bits.
+ */
+
+#ifndef MEMBLOCK_H_
+#define MEMBLOCK_H_
+
+#include <physmem.h>
+
+/** @brief Máximo número de regiones reservadas con el asignador temprano.
+ * Las reservas consecutivas se combinan en una sola región. */
+#define MEMBLOCK_MAX_REGIONS 16
+
+/** @brief Regiones reservadas con el asignador temprano. Estas regiones se
+ * excluyen de physmem_ranges y nunca se liberan. */
+extern physmem_range memblock_regions[];
+
+/** @brief Número de regiones reservadas con el asignador temprano */
+extern int memblock_region_count;
+
+/** @brief Dirección física en la cual termina la memoria mapeada durante el
+ * arranque: el kernel, las tablas de página iniciales y las reservas de
+ * memblock_alloc. */
+extern unsigned int memblock_mapped_end;
+
+/**
+ * @brief Detecta las regiones de memoria utilizables a partir de la
+ * información de GRUB, excluyendo el kernel, los módulos y las tablas de
+ * página iniciales, y habilita el asignador temprano. Se puede invocar
+ * antes de setup_physical_memory; si no se invoca, setup_physical_memory
+ * lo hace.
+ */
+void setup_memblock(void);
+
+/**
+ * @brief Reserva memoria con el asignador temprano, y la mapea en el
+ * espacio del kernel (a partir de KERNEL_VIRT_OFFSET). La memoria que se
+ * puede reservar está limitada por las tablas de página iniciales, que
+ * cubren al menos 4 MB a continuación del kernel.
+ * @param size Tamaño en bytes. Se redondea a un múltiplo de FRAME_SIZE.
+ * @return Dirección virtual de la memoria reservada, 0 si no existe
+ * memoria disponible o el asignador de marcos ya fue inicializado.
+ */
+void * memblock_alloc(unsigned int size);
+
+/**
+ * @brief Reserva memoria física con el asignador temprano, sin mapearla.
+ * @param size Tamaño en bytes. Se redondea a un múltiplo de FRAME_SIZE.
+ * @param limit La memoria reservada debe terminar en o antes de esta
+ * dirección física.
+ * @return Dirección física de la memoria reservada, 0 si no existe
+ * memoria disponible o el asignador de marcos ya fue inicializado.
+ */
+unsigned int memblock_alloc_phys(unsigned int size, unsigned int limit);
+
+/**
+ * @brief Deshabilita el asignador temprano. setup_physical_memory lo
+ * invoca antes de entregar las regiones utilizables al asignador de marcos.
+ */
+void memblock_finish(void);
+
+#endif /* MEMBLOCK_H_ */
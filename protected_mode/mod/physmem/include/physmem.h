@@ -25,26 +25,165 @@
 
 #define PHYSMEM_REGION_COUNT (PHYSMEM_MAXSIZE / PHYSMEM_GRANULARITY)
 
+/** @brief Máximo número de regiones utilizables que se toman del mapa de
+ * memoria de GRUB */
+#define PHYSMEM_MAX_RANGES 32
+
+/** @brief Máximo número de regiones de memoria: cada región utilizable
+ * puede compartir un bloque de PHYSMEM_GRANULARITY con otra */
+#define PHYSMEM_MAX_REGIONS (PHYSMEM_REGION_COUNT + 1 + PHYSMEM_MAX_RANGES)
+
 /** @brief Limite inferior de la memoria fisica  = 16 MB */
 #define PHYSMEM_LOW_LIMIT 0x1000000
 
+/** @brief Primer marco ubicado por encima de 4 GB */
+#define PHYSMEM_HIGH_START_FRAME 0x100000
+
+/** @brief Máximo número de marcos por encima de 4 GB que se gestionan en
+ * modo PAE (PAGING_PAE en paging.h): 1M marcos = 4 GB */
+#define PHYSMEM_HIGH_MAXFRAMES 0x100000
+
+/** @brief Zona de memoria por debajo de PHYSMEM_LOW_LIMIT, accesible por
+ * DMA ISA y por controladores con direccionamiento limitado */
+#define PHYSMEM_ZONE_DMA 0
+
+/** @brief Zona de memoria a partir de PHYSMEM_LOW_LIMIT */
+#define PHYSMEM_ZONE_NORMAL 1
+
+/** @brief Número de zonas de memoria */
+#define PHYSMEM_ZONES 2
+
+/** @brief Marcos de la zona DMA que no se entregan a las asignaciones de la
+ * zona normal (1 MB) */
+#define PHYSMEM_DMA_RESERVE 256
+
+/** @brief Si se define, la memoria física se gestiona con un asignador
+ * buddy (buddy.h) con bloques de 4 KB a 4 MB, en lugar de un mapa de bits
+ * por cada región de PHYSMEM_GRANULARITY bytes. */
+/* #define PHYSMEM_BUDDY */
+
 /** @brief Redondea una dirección dada al inicio del marco */
 #define ROUND_DOWN_TO_FRAME(value) ((int)(value / FRAME_SIZE) * FRAME_SIZE)
 
 /** @brief Redondea una dirección dada al inicio del siguiente marco */
 #define ROUND_UP_TO_FRAME(value) (((int)(value / FRAME_SIZE) + 1) * FRAME_SIZE)
 
-/* @brief Numero total de marcos de pagina disponibles */
+/** @brief Capacidad del cache de marcos libres */
+#define FRAME_CACHE_SIZE 64
+
+/** @brief Orden del bloque de marcos que se toma del asignador al recargar
+ * el cache */
+#define FRAME_CACHE_BATCH_ORDER 5
+
+/** @brief Marcos que se toman del mapa de bits cuando el cache está vacío,
+ * y que se devuelven cuando está lleno */
+#define FRAME_CACHE_BATCH (1 << FRAME_CACHE_BATCH_ORDER)
+
+/** @brief Cache de marcos libres (pila LIFO). Los marcos liberados se
+ * entregan de nuevo primero, mientras posiblemente aún se encuentran en la
+ * memoria cache del procesador. */
+typedef struct {
+    /** @brief Número de marcos almacenados */
+    int count;
+    /** @brief Direcciones de los marcos. El último es el más reciente. */
+    unsigned int frames[FRAME_CACHE_SIZE];
+}frame_cache;
+
+/** @brief Región de memoria física utilizable */
+typedef struct {
+    /** @brief Dirección de inicio de la región (alineada a FRAME_SIZE) */
+    unsigned int start;
+    /** @brief Tamaño en bytes de la región (múltiplo de FRAME_SIZE) */
+    unsigned int length;
+}physmem_range;
+
+/** @brief El marco no pertenece a una región utilizable, o contiene datos
+ * del kernel que no se liberan (por ejemplo los descriptores de marco). Los
+ * marcos reservados no se devuelven al asignador. */
+#define FRAME_DESC_RESERVED 0x1
+
+/** @brief El contenido del marco fue modificado y se debe escribir antes de
+ * reutilizarlo */
+#define FRAME_DESC_DIRTY 0x2
+
+/** @brief El marco se encuentra enlazado en una lista LRU */
+#define FRAME_DESC_LRU 0x4
+
+/** @brief Descriptor de un marco de página. Existe un descriptor por cada
+ * marco del rango [memory_start, memory_start + memory_length), incluidos
+ * los huecos entre regiones utilizables. */
+typedef struct {
+    /** @brief Número de referencias al marco. 0 = libre. */
+    unsigned short refcount;
+    /** @brief FRAME_DESC_RESERVED | FRAME_DESC_DIRTY | FRAME_DESC_LRU */
+    unsigned short flags;
+    /** @brief Número del marco anterior en la lista LRU, 0 = ninguno */
+    unsigned int lru_prev;
+    /** @brief Número del marco siguiente en la lista LRU, 0 = ninguno */
+    unsigned int lru_next;
+}frame_desc;
+
+/* @brief Numero total de marcos de pagina disponibles, sin contar los
+ * marcos almacenados en el cache */
 extern int physmem_available_frames;
 
+/** @brief Regiones de memoria utilizables, ordenadas por dirección */
+extern physmem_range physmem_ranges[];
+
+/** @brief Número de regiones de memoria utilizables */
+extern int physmem_range_count;
+
+/** @brief Región física que ocupa el arreglo de descriptores de marco. Se
+ * reserva con el asignador temprano (memblock.h), y paging.c la incluye en
+ * el mapa directo. Su tamaño es 0 si no se pudo reservar. */
+extern physmem_range frame_desc_range;
+
+/** @brief Arreglo de descriptores de marco, indexado por número de marco a
+ * partir de frame_desc_first. Es 0 si los descriptores no están
+ * disponibles. */
+extern frame_desc * frame_descs;
+
+/** @brief Número del primer marco que tiene descriptor */
+extern unsigned int frame_desc_first;
+
+/** @brief Número de descriptores de marco */
+extern unsigned int frame_desc_count;
+
 /**
- * @brief Inicializa el mapa de bits de memoria,
- * a partir de la informacion obtenida del GRUB.
+ * @brief Inicializa el mapa de bits de memoria, a partir de las regiones
+ * utilizables detectadas por setup_memblock (memblock.h). Después de esta
+ * rutina ya no se puede usar el asignador temprano.
  */
 void setup_physical_memory(void);
 
 /**
- @brief Busca un marco libre dentro del mapa de bits de memoria.
+ * @brief Inicializa los descriptores de marco a partir del estado del
+ * asignador, e imprime la memoria que ocupan. Se debe invocar después de
+ * setup_paging, dado que el arreglo se accede mediante el mapa directo.
+ */
+void setup_frame_descriptors(void);
+
+/**
+ * @brief Obtiene el descriptor de un marco de página.
+ * @param addr Dirección física del marco
+ * @return Apuntador al descriptor, 0 si el marco no tiene descriptor
+ */
+frame_desc * get_frame_desc(unsigned int addr);
+
+/**
+ * @brief Agrega una referencia a un marco asignado, por ejemplo al mapearlo
+ * en otra dirección. Cada referencia se debe liberar con free_frame; el
+ * marco vuelve al asignador al liberar la última.
+ * @param addr Dirección física del marco
+ * @return Número de referencias del marco, 0 si no tiene descriptor o no
+ * se encuentra asignado
+ */
+int share_frame(unsigned int addr);
+
+/**
+ @brief Busca un marco libre dentro del mapa de bits de memoria. El marco
+ * se toma del cache de marcos libres, que se recarga desde el mapa de bits
+ * cuando está vacío. Se puede invocar desde un manejador de interrupción.
  * @return Dirección de inicio del marco.
  */
 unsigned int allocate_frame(void);
@@ -57,17 +196,114 @@ unsigned int allocate_frame(void);
  */
 unsigned int allocate_frame_region(unsigned int length);
 
+/** 
+ * @brief Busca una región de memoria contigua libre, cuya dirección de
+ * inicio sea múltiplo de la alineación solicitada (por ejemplo 4 MB para
+ * páginas grandes o 64 KB para DMA).
+ * @param length Tamaño de la región de memoria a asignar.
+ * @param alignment Alineación en bytes de la región (potencia de 2).
+ * @return Dirección de inicio de la región en memoria, 0 si no existe.
+ */
+unsigned int allocate_frame_region_aligned(unsigned int length,
+        unsigned int alignment);
+
 /**
- * @brief Permite liberar un marco de página
+ * @brief Reserva un marco libre de una zona de memoria. Las asignaciones
+ * de la zona normal usan la zona DMA solo si ésta conserva
+ * PHYSMEM_DMA_RESERVE marcos libres. Las asignaciones de la zona DMA no
+ * usan otra zona.
+ * @param zone PHYSMEM_ZONE_DMA | PHYSMEM_ZONE_NORMAL
+ * @return Dirección de inicio del marco, 0 si no existe
+ */
+unsigned int allocate_frame_zone(int zone);
+
+/** 
+ * @brief Busca una región de memoria contigua libre en una zona de memoria,
+ * con la misma politica de allocate_frame_zone. Para buffers de DMA ISA o
+ * de bus master IDE que no deben cruzar un limite de 64 KB, se puede usar
+ * una alineación igual al tamaño redondeado a una potencia de 2 (máximo
+ * 64 KB).
+ * @param length Tamaño de la región de memoria a asignar.
+ * @param alignment Alineación en bytes de la región (potencia de 2).
+ * @param zone PHYSMEM_ZONE_DMA | PHYSMEM_ZONE_NORMAL
+ * @return Dirección de inicio de la región en memoria, 0 si no existe.
+ */
+unsigned int allocate_frame_region_zone(unsigned int length,
+        unsigned int alignment, int zone);
+
+/**
+ * @brief Permite liberar un marco de página. El marco se almacena en el
+ * cache de marcos libres. Se puede invocar desde un manejador de
+ * interrupción.
  * @param addr Dirección de inicio del marco. Se redondea hacia abajo si no es
  * múltiplo de PAGE_SIZE
  */
 void free_frame(unsigned int addr);
 
+/**
+ * @brief Libera un conjunto de marcos de página. Los marcos que pertenecen
+ * a la misma entrada del mapa de bits se liberan con una sola escritura,
+ * por lo cual es conveniente que las direcciones se encuentren ordenadas.
+ * @param addrs Direcciones de inicio de los marcos
+ * @param count Número de marcos a liberar
+ */
+void free_frames(unsigned int * addrs, int count);
+
+/**
+ * @brief Libera una región de marcos contiguos, por ejemplo una región
+ * reservada con allocate_frame_region_aligned. Los marcos no pasan por el
+ * cache de marcos libres.
+ * @param addr Dirección de inicio de la región
+ * @param length Tamaño de la región en bytes
+ */
+void free_frame_region(unsigned int addr, unsigned int length);
+
+/**
+ * @brief Devuelve al mapa de bits todos los marcos del cache de marcos
+ * libres.
+ */
+void flush_frame_cache(void);
+
+/**
+ * @brief Reserva un marco de página ubicado por encima de 4 GB. Solo existen
+ * estos marcos en modo PAE (PAGING_PAE en paging.h); para accederlos se
+ * deben mapear con map_page_frame.
+ * @return Número del marco (dirección física / FRAME_SIZE), 0 si no existen
+ * marcos disponibles
+ */
+unsigned int allocate_high_frame(void);
+
+/**
+ * @brief Libera un marco de página indicado por su número, ubicado por
+ * debajo o por encima de 4 GB.
+ * @param frame Número del marco (dirección física / FRAME_SIZE)
+ */
+void free_frame_number(unsigned int frame);
+
+/**
+ * @brief Retorna el número de marcos libres por encima de 4 GB
+ * @return Número de marcos disponibles, 0 si no se usa PAE
+ */
+int available_high_frames(void);
+
 /**
  * @brief Retorna el número de marcos de mágina libres
  * @return Número de marcos de página disponibles
  */
 int available_frames();
 
+/**
+ * @brief Retorna el número de marcos libres de una región utilizable
+ * @param index Posición de la región en physmem_ranges
+ * @return Número de marcos de página disponibles en la región
+ */
+int available_frames_in_range(int index);
+
+/**
+ * @brief Retorna el número de marcos libres de una zona de memoria
+ * @param zone PHYSMEM_ZONE_DMA | PHYSMEM_ZONE_NORMAL
+ * @return Número de marcos de página disponibles en la zona
+ */
+int available_frames_in_zone(int zone);
+
 #endif /* PHYSMEM_H_ */
@@ -0,0 +1,426 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementación del asignador temprano de memoria
+ * física (memblock). Las reservas se toman del inicio de las regiones
+ * utilizables, que luego se entregan al asignador de marcos.
+ */
+#include <asm.h>
+#include <memblock.h>
+#include <multiboot.h>
+#include <paging.h>
+#include <physmem.h>
+#include <pm.h>
+#include <stdlib.h>
+
+/** @brief Dirección virtual de las tablas de página iniciales de start.S,
+ * mediante el mapeo recursivo de la última entrada del directorio */
+#define MEMBLOCK_BOOT_PT_VADDR 0xFFC00000
+
+/** @brief Entrada del directorio de tablas de página iniciales que se usa
+ * para el mapeo recursivo */
+#define MEMBLOCK_BOOT_PD_SELF 1023
+
+/** @brief Regiones reservadas con el asignador temprano */
+physmem_range memblock_regions[MEMBLOCK_MAX_REGIONS];
+
+/** @brief Número de regiones reservadas con el asignador temprano */
+int memblock_region_count;
+
+/** @brief Dirección física en la cual termina la memoria mapeada durante el
+ * arranque */
+unsigned int memblock_mapped_end;
+
+/** @brief Dirección física hasta la cual las tablas de página iniciales
+ * permiten mapear la memoria reservada con memblock_alloc */
+static unsigned int memblock_map_limit;
+
+/** @brief Estado del asignador temprano: 0 = sin inicializar, 1 = activo,
+ * 2 = la memoria ya se entregó al asignador de marcos */
+static int memblock_state = 0;
+
+/* Variables definidas en start.S */
+extern unsigned int kernel_initial_pagetables_end;
+extern unsigned int kernel_page_tables;
+extern unsigned int kernel_large_pages;
+extern unsigned int multiboot_info_location;
+
+/* Variables definidas en physmem.c */
+extern unsigned int memory_start;
+extern unsigned int memory_length;
+extern unsigned int allowed_free_start;
+#ifdef PAGING_PAE
+extern physmem_range physmem_high_ranges[];
+extern int physmem_high_range_count;
+#endif
+
+/**
+ * @brief Adiciona una region utilizable a la lista ordenada de regiones,
+ * combinandola con las regiones adyacentes o superpuestas.
+ * @param start Inicio de la region, alineado a FRAME_SIZE
+ * @param end Fin de la region, alineado a FRAME_SIZE
+ */
+static void memblock_add_range(unsigned int start, unsigned int end) {
+    int i;
+    int j;
+
+    if (start >= end) {
+        return;
+    }
+
+    /* Ubicar la posicion de la region en la lista ordenada */
+    i = 0;
+    while (i < physmem_range_count && 
+            physmem_ranges[i].start + physmem_ranges[i].length < start) {
+        i++;
+    }
+
+    /* Combinar con las regiones que se superponen o son adyacentes */
+    if (i < physmem_range_count && physmem_ranges[i].start <= end) {
+        if (start < physmem_ranges[i].start) {
+            physmem_ranges[i].length += physmem_ranges[i].start - start;
+            physmem_ranges[i].start = start;
+        }
+        if (end > physmem_ranges[i].start + physmem_ranges[i].length) {
+            physmem_ranges[i].length = end - physmem_ranges[i].start;
+        }
+        /* La region puede haber alcanzado a las siguientes */
+        while (i + 1 < physmem_range_count && 
+                physmem_ranges[i + 1].start <=
+                physmem_ranges[i].start + physmem_ranges[i].length) {
+            end = physmem_ranges[i + 1].start + physmem_ranges[i + 1].length;
+            if (end > physmem_ranges[i].start + physmem_ranges[i].length) {
+                physmem_ranges[i].length = end - physmem_ranges[i].start;
+            }
+            for (j = i + 1; j < physmem_range_count - 1; j++) {
+                physmem_ranges[j] = physmem_ranges[j + 1];
+            }
+            physmem_range_count--;
+        }
+        return;
+    }
+
+    /* No hay espacio para mas regiones */
+    if (physmem_range_count == PHYSMEM_MAX_RANGES) {
+        return;
+    }
+
+    /* Insertar la nueva region en la posicion i */
+    for (j = physmem_range_count; j > i; j--) {
+        physmem_ranges[j] = physmem_ranges[j - 1];
+    }
+    physmem_ranges[i].start = start;
+    physmem_ranges[i].length = end - start;
+    physmem_range_count++;
+}
+
+#ifdef PAGING_PAE
+/**
+ * @brief Almacena la parte de una region del mapa de memoria de GRUB que se
+ * encuentra por encima de 4 GB, expresada en marcos.
+ * @param mmap Entrada del mapa de memoria
+ */
+static void memblock_add_high_range(memory_map_t * mmap) {
+    unsigned long long end;
+    unsigned int start_frame;
+    unsigned int end_frame;
+
+    if (physmem_high_range_count == PHYSMEM_MAX_RANGES) {
+        return;
+    }
+
+    end = (((unsigned long long)mmap->base_addr_high << 32) 
+            | mmap->base_addr_low)
+        + (((unsigned long long)mmap->length_high << 32) | mmap->length_low);
+
+    /* Redondear el inicio al siguiente marco */
+    start_frame = (mmap->base_addr_high << 20) | (mmap->base_addr_low >> 12);
+    if (mmap->base_addr_low & (FRAME_SIZE - 1)) {
+        start_frame++;
+    }
+    end_frame = (unsigned int)(end >> 12);
+
+    /* Tomar solo la parte por encima de 4 GB que se puede gestionar */
+    if (start_frame < PHYSMEM_HIGH_START_FRAME) {
+        start_frame = PHYSMEM_HIGH_START_FRAME;
+    }
+    if (end_frame > PHYSMEM_HIGH_START_FRAME + PHYSMEM_HIGH_MAXFRAMES) {
+        end_frame = PHYSMEM_HIGH_START_FRAME + PHYSMEM_HIGH_MAXFRAMES;
+    }
+
+    if (start_frame >= end_frame) {
+        return;
+    }
+
+    physmem_high_ranges[physmem_high_range_count].start = start_frame;
+    physmem_high_ranges[physmem_high_range_count].length = 
+        end_frame - start_frame;
+    physmem_high_range_count++;
+}
+#endif
+
+/**
+ * @brief Detecta las regiones de memoria utilizables, a partir de la
+ * informacion proporcionada por GRUB.
+ * Se toman todas las regiones de memoria disponibles ubicadas a partir de
+ * 1 MB, excluyendo el kernel, los modulos y las tablas de pagina iniciales.
+ */
+void setup_memblock(void) {
+
+	/* Variables temporales para hallar las regiones de memoria disponibles */
+	unsigned int tmp_start;
+	unsigned int tmp_end;
+	unsigned int reserved_end;
+	int mod_count;
+    unsigned int mmap_address;
+    unsigned int mods_address;
+
+    if (memblock_state != 0) {
+        return;
+    }
+    memblock_state = 1;
+
+    /* Las tablas de página iniciales mapean el kernel a partir de 0, y
+     * start.S adiciona una tabla de páginas (o una página de 4 MB) para las
+     * reservas de memblock_alloc */
+    memblock_mapped_end = kernel_initial_pagetables_end;
+    if (kernel_large_pages > 0) {
+        memblock_map_limit = kernel_large_pages * PSE_PAGE_SIZE;
+    }else {
+        memblock_map_limit = kernel_page_tables * PSE_PAGE_SIZE;
+    }
+
+    /* Dado que ya se habilitó la memoria virtual, se debe usar la
+     * dirección virtual en la cual se encuentra mapeada la estructura de
+     * información multiboot. */
+	multiboot_info_t * info = (multiboot_info_t *)(multiboot_info_location 
+            + KERNEL_VIRT_OFFSET);
+
+    /* Almacena la dirección de memoria final del ultimo modulo cargado, o
+     * 0 si no se cargaron modulos. */
+	unsigned int mods_end; 
+
+	/* si flags[3] = 1, se especificaron módulos que deben ser cargados junto
+	 * con el kernel y justo después del mismo. */
+	mods_end = 0;
+
+    /* Se debe sumar KERNEL_VIRT_OFFSET a la dirección, dado que ya se
+     * activó la memoria virtual. */
+	if (test_bit(info->flags, 3)) {
+		mod_info_t * mod_info;
+        mods_address = info->mods_addr + KERNEL_VIRT_OFFSET;
+		for (mod_info = (mod_info_t*)(mods_address), mod_count=0;
+				mod_count < info->mods_count;
+				mod_count++, mod_info++) {
+			if (mod_info->mod_end > mods_end) {
+				/* Los modulos se redondean a limites de 4 KB, redondear
+				 * la dirección final del modulo a un limite de 4096 */
+				mods_end = (mod_info->mod_end + FRAME_SIZE - 1)
+                    & ~(FRAME_SIZE - 1);
+			}
+		}
+	}
+
+	memory_start = 0;
+	memory_length = 0;
+
+    physmem_range_count = 0;
+    memblock_region_count = 0;
+#ifdef PAGING_PAE
+    physmem_high_range_count = 0;
+#endif
+
+	/* El kernel, los módulos, el directorio de tablas de página y
+     * las tablas de página del kernel ocupan la memoria desde
+     * KERNEL_PHYS_ADDR hasta reserved_end. */
+	reserved_end = kernel_initial_pagetables_end;
+    if (mods_end > reserved_end) {
+        reserved_end = mods_end;
+    }
+	allowed_free_start = reserved_end;
+
+	/* si flags[6] = 1, los campos mmap_length y mmap_addr son validos */
+
+	/** Existe un mapa de memoria válido creado por GRUB? */
+	if (test_bit(info->flags, 6)) {
+        
+		memory_map_t *mmap;
+
+        /* Calcular la dirección virtual del mapa de memoria*/
+        mmap_address = info->mmap_addr + KERNEL_VIRT_OFFSET;
+
+		for (mmap = (memory_map_t *) (mmap_address);
+			(unsigned int) mmap < mmap_address +  info->mmap_length;
+			mmap = (memory_map_t *) ((unsigned int) mmap
+									 + mmap->entry_size
+									 + sizeof (mmap->entry_size))) {
+
+	  /** Verificar si la región de memoria cumple con las condiciones
+	   * para ser considerada "memoria disponible":
+	   *
+	   * - Tener su atributo 'type' en 1 = memoria disponible.
+	   * - Estar ubicada por debajo de 4 GB (base_addr_high = 0). La parte
+	   *   de la región que supere PHYSMEM_MAXFRAMES marcos se descarta.
+	   *   En modo PAE, la parte ubicada por encima de 4 GB se gestiona
+	   *   por separado en números de marco.
+	   *
+	   * Solo se toma la parte de la región ubicada a partir de 1 MB, y
+	   * se excluye la memoria ocupada por el kernel, los módulos y las
+	   * tablas de página iniciales.
+	   * */
+         if (mmap->type != 1) {
+             continue;
+         }
+
+#ifdef PAGING_PAE
+         memblock_add_high_range(mmap);
+#endif
+
+		 if (mmap->base_addr_high != 0) {
+             continue;
+         }
+
+         tmp_start = mmap->base_addr_low;
+         tmp_end = tmp_start + mmap->length_low;
+
+         /* La región termina por encima del limite gestionable? */
+         if (mmap->length_high != 0 || tmp_end < tmp_start ||
+                 tmp_end > PHYSMEM_MAXFRAMES * FRAME_SIZE) {
+             tmp_end = PHYSMEM_MAXFRAMES * FRAME_SIZE;
+         }
+
+         if (tmp_start < KERNEL_PHYS_ADDR) {
+             tmp_start = KERNEL_PHYS_ADDR;
+         }
+
+         /* Excluir el kernel, los modulos y las tablas de pagina */
+         if (tmp_start < reserved_end && tmp_end > KERNEL_PHYS_ADDR) {
+             tmp_start = reserved_end;
+         }
+
+         /* Redondear el inicio y el fin de la región a marcos */
+         tmp_start = (tmp_start + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+         tmp_end = tmp_end & ~(FRAME_SIZE - 1);
+
+         memblock_add_range(tmp_start, tmp_end);
+		} //endfor
+	}
+
+	/* Existe alguna región de memoria disponible? */
+	if (physmem_range_count == 0) {
+        return;
+    }
+
+    /* Actualizar las variables globales del kernel */
+    memory_start = physmem_ranges[0].start;
+    memory_length = physmem_ranges[physmem_range_count - 1].start 
+        + physmem_ranges[physmem_range_count - 1].length
+        - memory_start;
+}
+
+/**
+ * @brief Toma memoria del inicio de la primera region utilizable en la
+ * cual cabe, por debajo de un limite.
+ * @param size Tamaño en bytes, multiplo de FRAME_SIZE
+ * @param limit Direccion fisica en o antes de la cual debe terminar
+ * @return Direccion fisica de la memoria, 0 si no existe
+ */
+static unsigned int memblock_take(unsigned int size, unsigned int limit) {
+    int i;
+    unsigned int addr;
+    physmem_range * last;
+
+    if (memblock_state != 1 || size == 0) {
+        return 0;
+    }
+
+    /* Las regiones se encuentran ordenadas por direccion. Una region
+     * utilizable no se consume completamente. */
+    for (i = 0; i < physmem_range_count; i++) {
+        addr = physmem_ranges[i].start;
+        if (addr >= limit || size > limit - addr) {
+            return 0;
+        }
+        if (physmem_ranges[i].length <= size) {
+            continue;
+        }
+
+        /* Combinar con la reserva anterior si es contigua */
+        last = 0;
+        if (memblock_region_count > 0) {
+            last = &memblock_regions[memblock_region_count - 1];
+        }
+        if (last != 0 && last->start + last->length == addr) {
+            last->length += size;
+        }else if (memblock_region_count < MEMBLOCK_MAX_REGIONS) {
+            memblock_regions[memblock_region_count].start = addr;
+            memblock_regions[memblock_region_count].length = size;
+            memblock_region_count++;
+        }else {
+            return 0;
+        }
+
+        physmem_ranges[i].start += size;
+        physmem_ranges[i].length -= size;
+        return addr;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reserva memoria con el asignador temprano, y la mapea en el
+ * espacio del kernel.
+ */
+void * memblock_alloc(unsigned int size) {
+    unsigned int addr;
+    unsigned int end;
+    unsigned int * pd;
+    unsigned int * pt;
+
+    size = (size + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+
+    addr = memblock_take(size, memblock_map_limit);
+    if (addr == 0) {
+        return 0;
+    }
+    end = addr + size;
+
+    /* Si el kernel se mapeó con tablas de página, escribir las entradas de
+     * las páginas reservadas. Las tablas se acceden mediante el mapeo
+     * recursivo, que setup_paging también establece. Las tablas son
+     * compartidas por el mapeo 1:1 y el mapeo a partir de
+     * KERNEL_VIRT_OFFSET, y las entradas no estaban presentes, por lo cual
+     * no se requiere invalidar el TLB. */
+    if (kernel_large_pages == 0) {
+        pd = (unsigned int *)(kernel_pd_addr + KERNEL_VIRT_OFFSET);
+        pd[MEMBLOCK_BOOT_PD_SELF] = kernel_pd_addr | PG_KERNEL_PRESENT;
+        for (; addr < end; addr += FRAME_SIZE) {
+            pt = (unsigned int *)(MEMBLOCK_BOOT_PT_VADDR 
+                    + (addr / PSE_PAGE_SIZE) * FRAME_SIZE);
+            pt[(addr / FRAME_SIZE) % 1024] = addr | PG_KERNEL_PRESENT;
+        }
+    }
+
+    if (end > memblock_mapped_end) {
+        memblock_mapped_end = end;
+    }
+
+    return (void *)(end - size + KERNEL_VIRT_OFFSET);
+}
+
+/**
+ * @brief Reserva memoria física con el asignador temprano, sin mapearla.
+ */
+unsigned int memblock_alloc_phys(unsigned int size, unsigned int limit) {
+    size = (size + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+    return memblock_take(size, limit);
+}
+
+/**
+ * @brief Deshabilita el asignador temprano.
+ */
+void memblock_finish(void) {
+    memblock_state = 2;
+}
@@ -10,19 +10,55 @@
  */
 #include <asm.h>
 #include <bitmap.h>
-//#include <console.h>
+#include <buddy.h>
+#include <console.h>
+#include <memblock.h>
 #include <pm.h>
 #include <physmem.h>
 #include <multiboot.h>
+#include <paging.h>
 #include <stdlib.h>
 
-/** @brief Mapa de bits de la memoria fisica. */
-unsigned int 
-    physical_memory_bitmap[PHYSMEM_MAXFRAMES / BITS_PER_BITMAP_ENTRY] 
-    __attribute__((aligned(4096)));
+#ifdef PHYSMEM_BUDDY
+
+/** @brief Asignadores buddy de la memoria fisica, uno por zona. Sus mapas
+ * de bits se reservan con el asignador temprano (memblock.c), de acuerdo
+ * con la memoria detectada. */
+buddy physmem_buddy[PHYSMEM_ZONES];
+
+#else
+
+/** @brief Indice de regiones: para cada bloque de PHYSMEM_GRANULARITY bytes
+ * de memoria fisica, apuntador a la primera region que inicia en el. */
+memory_region * physmem_index[PHYSMEM_REGION_COUNT + 1];
+
+#endif
+
+/** @brief Limites de las zonas de memoria fisica. La zona i comprende las
+ * direcciones [physmem_zone_limits[i], physmem_zone_limits[i + 1]). */
+static const unsigned int physmem_zone_limits[PHYSMEM_ZONES + 1] = {
+    0,
+    PHYSMEM_LOW_LIMIT,
+    PHYSMEM_MAXFRAMES * FRAME_SIZE
+};
+
+#ifdef PAGING_PAE
+
+/** @brief Asignador buddy de la memoria ubicada por encima de 4 GB, que se
+ * gestiona en numeros de marco */
+buddy physmem_high_buddy;
+
+/** @brief Regiones utilizables por encima de 4 GB. El inicio y el tamaño
+ * se expresan en marcos. */
+physmem_range physmem_high_ranges[PHYSMEM_MAX_RANGES];
+
+/** @brief Número de regiones utilizables por encima de 4 GB */
+int physmem_high_range_count;
+
+#endif
 
 /** @brief Lista de regiones fisicas de memoria */
-memory_region physmem[PHYSMEM_REGION_COUNT];
+memory_region physmem[PHYSMEM_MAX_REGIONS];
 
 /** @brief Apuntador a la lista de regiones fisicas de memoria */
 memory_region * physmem_list = 0;
@@ -33,285 +69,499 @@ memory_region * current_physmem;
 /** @brief Numero de regiones de memoria disponibles */
 int physmem_count;
 
-/* @brief Numero total de marcos de pagina disponibles */
+/** @brief Regiones de memoria utilizables reportadas por GRUB, sin el
+ * kernel, los modulos y las tablas de pagina iniciales. */
+physmem_range physmem_ranges[PHYSMEM_MAX_RANGES];
+
+/** @brief Numero de regiones de memoria utilizables */
+int physmem_range_count;
+
+/* @brief Numero total de marcos de pagina disponibles, sin contar los
+ * marcos almacenados en el cache */
 int physmem_available_frames;
 
-/* Variable definida en start.S que almacena la dirección física en la cual
- * terminan las tablas de página iniciales del kernel */
-extern unsigned int kernel_initial_pagetables_end;
+/** @brief Región física que ocupa el arreglo de descriptores de marco */
+physmem_range frame_desc_range;
+
+/** @brief Arreglo de descriptores de marco */
+frame_desc * frame_descs = 0;
+
+/** @brief Número del primer marco que tiene descriptor */
+unsigned int frame_desc_first;
+
+/** @brief Número de descriptores de marco */
+unsigned int frame_desc_count;
+
+/** @brief Cache de marcos libres. En un kernel SMP se debe crear uno por
+ * cada procesador. */
+frame_cache physmem_frame_cache;
 
 /** @brief Mapa de bits de memoria disponible
  * @details Esta variable almacena el apuntador del inicio del mapa de bits
  * que permite gestionar las unidades de memoria. */
  unsigned int * memory_bitmap;
 
-/** @brief Variable global del kernel que almacena el inicio de la región
- * de memoria disponible */
+/** @brief Variable global del kernel que almacena el inicio de la memoria
+ * disponible (el inicio de la primera region utilizable) */
 unsigned int memory_start;
-/** @brief Variable global del kernel que almacena el tamano en bytes de
- * la memoria disponible */
+/** @brief Variable global del kernel que almacena el tamano en bytes del
+ * rango que abarcan las regiones de memoria utilizables */
 unsigned int memory_length;
 
 /** @brief Mínima dirección de memoria permitida para liberar */
 unsigned int allowed_free_start;
 
-/* @brief Variable que almacena la ubicación de la estructura multiboot en
- * memoria. Definida en start.S */
-extern unsigned int multiboot_info_location;
+/**
+ * @brief Retorna la zona de memoria a la cual pertenece una direccion
+ * fisica.
+ */
+static __inline__ int physmem_zone(unsigned int addr) {
+    int zone;
+
+    for (zone = PHYSMEM_ZONES - 1; zone > 0; zone--) {
+        if (addr >= physmem_zone_limits[zone]) {
+            break;
+        }
+    }
+    return zone;
+}
 
 /**
- * @brief Inicializa el mapa de bits de memoria, a partir de la informacion
- * proporcionada por GRUB.
+ * @brief Retorna la zona en la cual se puede buscar una asignacion que no
+ * se pudo satisfacer en la zona solicitada, o -1 si no existe.
+ * Las asignaciones normales pueden usar la zona DMA, siempre que en ella
+ * queden al menos PHYSMEM_DMA_RESERVE marcos libres. Las asignaciones de
+ * la zona DMA no tienen alternativa.
  */
-void setup_physical_memory(void){
+static int physmem_fallback_zone(int zone, unsigned int frame_count) {
+    if (zone == PHYSMEM_ZONE_NORMAL && 
+            available_frames_in_zone(PHYSMEM_ZONE_DMA) 
+                >= frame_count + PHYSMEM_DMA_RESERVE) {
+        return PHYSMEM_ZONE_DMA;
+    }
+    return -1;
+}
 
-    int i;
+#ifndef PHYSMEM_BUDDY
+/**
+ * @brief Crea las regiones de memoria (con su mapa de bits) para una region
+ * utilizable. Las regiones se alinean a limites fisicos de
+ * PHYSMEM_GRANULARITY, por lo cual cada region pertenece a una sola zona.
+ */
+static void physmem_add_regions(physmem_range * range,
+        unsigned int ** bitmap_ptr,
+        unsigned int ** summary_ptr) {
+    unsigned int tmp_start;
+    unsigned int tmp_end;
+    unsigned int end;
+    int slots;
+    memory_region * region;
+
+    tmp_start = range->start;
+    end = range->start + range->length;
+
+    while (tmp_start < end && physmem_count < PHYSMEM_MAX_REGIONS) {
+        /* Fin de esta region: el siguiente limite de PHYSMEM_GRANULARITY o
+         * el fin de la region utilizable */
+        tmp_end = (tmp_start & ~(PHYSMEM_GRANULARITY - 1)) 
+            + PHYSMEM_GRANULARITY;
+        if (tmp_end > end || tmp_end == 0) {
+            tmp_end = end;
+        }
 
-	extern multiboot_header_t multiboot_header;
+        region = &physmem[physmem_count];
+        region->start = tmp_start;
+        region->length = tmp_end - tmp_start;
+        region->next = 0;
+        region->prev = 0;
+        if (physmem_count > 0) {
+            region->prev = &physmem[physmem_count - 1];
+            physmem[physmem_count -1].next = region;
+        }
 
-    /* Apuntar al mapa de bits de memoria física. */
-    memory_bitmap = (unsigned int*)&physical_memory_bitmap;
+        slots = region->length / FRAME_SIZE;
 
-	/* Variables temporales para hallar la region de memoria disponible */
-	unsigned int tmp_start;
-	unsigned int tmp_length;
-	unsigned int tmp_end;
-	int mod_count;
-    unsigned int mmap_address;
-    unsigned int mods_address;
+        /* Inicializar el mapa de bits para esta region */
+        bitmap_init(&region->map, *bitmap_ptr, slots);
+        *bitmap_ptr += slots / BITS_PER_BITMAP_ENTRY;
 
-    unsigned int * tmp_ptr;
-    int slots;
+        /* Redondear al siguiente apuntador de entero sin signo si
+         * es necesario */
+        if (slots % BITS_PER_BITMAP_ENTRY != 0) {
+            (*bitmap_ptr)++;
+        }
 
-    /* Dado que ya se habilitó la memoria virtual, se debe usar la
-     * dirección virtual en la cual se encuentra mapeada la estructura de
-     * información multiboot. */
-	multiboot_info_t * info = (multiboot_info_t *)(multiboot_info_location 
-            + KERNEL_VIRT_OFFSET);
-
-    /* Almacena la dirección de memoria final del ultimo modulo cargado, o
-     * 0 si no se cargaron modulos. */
-	unsigned int mods_end; 
-
-	/* si flags[3] = 1, se especificaron módulos que deben ser cargados junto
-	 * con el kernel y justo después del mismo. */
-	mods_end = 0;
-
-    /* Se debe sumar KERNEL_VIRT_OFFSET a la dirección, dado que ya se
-     * activó la memoria virtual. */
-	if (test_bit(info->flags, 3)) {
-		mod_info_t * mod_info;
-        mods_address = info->mods_addr + KERNEL_VIRT_OFFSET;
-		for (mod_info = (mod_info_t*)(mods_address), mod_count=0;
-				mod_count < info->mods_count;
-				mod_count++, mod_info++) {
-			if (mod_info->mod_end > mods_end) {
-				/* Los modulos se redondean a limites de 4 KB, redondear
-				 * la dirección final del modulo a un limite de 4096 */
-				mods_end = mod_info->mod_end + (mod_info->mod_end % 4096);
-			}
-		}
-	}
+        /* Adicionar el resumen, para no recorrer entradas llenas */
+        bitmap_init_summary(&region->map, *summary_ptr, 0);
+        *summary_ptr += region->map.summary_entries;
 
+        /* Registrar la region en el indice. Un bloque puede contener
+         * varias regiones, que quedan consecutivas en physmem. */
+        if (physmem_index[tmp_start / PHYSMEM_GRANULARITY] == 0) {
+            physmem_index[tmp_start / PHYSMEM_GRANULARITY] = region;
+        }
 
-	/* si flags[6] = 1, los campos mmap_length y mmap_addr son validos */
+        physmem_count++;
+        physmem_available_frames += slots;
 
-	/* Revisar las regiones de memoria, y extraer la region de memoria
-	 * de mayor tamano, marcada como disponible, cuya dirección base sea
-	* mayor o igual a la posicion del kernel en memoria.
-	*/
+        tmp_start = tmp_end;
+    }
+}
 
-	memory_start = 0;
-	memory_length = 0;
+/**
+ * @brief Busca la region que contiene una direccion fisica, a partir del
+ * indice de bloques de PHYSMEM_GRANULARITY bytes.
+ * @param addr Direccion fisica
+ * @return Region que contiene la direccion, 0 si no existe
+ */
+static memory_region * physmem_find_region(unsigned int addr) {
+    memory_region * aux;
 
-    physmem_count = 0;
-    physmem_available_frames = 0;
+    aux = physmem_index[addr / PHYSMEM_GRANULARITY];
+    if (aux == 0) {
+        return 0;
+    }
 
-	/* Suponer que el inicio de la memoria disponible se encuentra
-	 * al finalizar el kernel, los módulos, el directorio de tablas de página y
-     * las tablas de página del kernel. */
-	allowed_free_start = kernel_initial_pagetables_end;
-
-	/** Existe un mapa de memoria válido creado por GRUB? */
-	if (test_bit(info->flags, 6)) {
-        
-		memory_map_t *mmap;
-
-        /* Calcular la dirección virtual del mapa de memoria*/
-        mmap_address = info->mmap_addr + KERNEL_VIRT_OFFSET;
-
-		for (mmap = (memory_map_t *) (mmap_address);
-			(unsigned int) mmap < mmap_address +  info->mmap_length;
-			mmap = (memory_map_t *) ((unsigned int) mmap
-									 + mmap->entry_size
-									 + sizeof (mmap->entry_size))) {
-
-	  /** Verificar si la región de memoria cumple con las condiciones
-	   * para ser considerada "memoria disponible".
-	   *
-	   * Importante: Si se supone un procesador de 32 bits, los valores
-	   * de la parte alta de base y length (base_addr_high y
-	   * length_high) son cero. Por esta razon se pueden ignorar y solo
-	   * se usan los 32 bits menos significativos de base y length.
-	   *
-	   * Para que una region de memoria sea considerada "memoria
-	   * disponible", debe cumplir con las siguientes condiciones:
-	   *
-	   * - Estar ubicada en una posicion de memoria mayor o igual que
-	   * 	1 MB.
-	   * - Tener su atributo 'type' en 1 = memoria disponible.
-	   * */
-		 /* La region esta marcada como disponible y su dirección base
-		  * es igual o superior a 1 MB? */
-		 if (mmap->type == 1 && mmap->base_addr_low >= 0x100000)  {
-			 tmp_start = mmap->base_addr_low;
-			 tmp_length = mmap->length_low;
-
-			 /* Verificar si el kernel se encuentra en esta region */
-			 if (kernel_initial_pagetables_end >= tmp_start &&
-					kernel_initial_pagetables_end <= tmp_start + tmp_length) {
-				 /* El kernel se encuentra en esta region. Tomar el inicio
-				  * de la memoria disponible en la posicion en la cual
-				  * finaliza el kernel
-				 */
-				 tmp_start =kernel_initial_pagetables_end;
-
-				 /* Ahora verificar si ser cargaron módulos junto con el
-				  * kernel. Estos modulos se cargan en regiones continuas
-				  * al kernel.
-				  * Si es así, la nueva posición inicial de la memoria
-				  * disponible es la posición en la cual terminan los módulos
-				  * */
-				 if (mods_end > 0 &&
-						 mods_end >= tmp_start &&
-						 mods_end <= tmp_start + tmp_length) {
-						tmp_start = mods_end;
-				 }
-				 /* Restar al espacio disponible.*/
-				 tmp_length -= tmp_start - mmap->base_addr_low;
-				 if (tmp_length > memory_length) {
-					 memory_start = tmp_start;
-					 memory_length = tmp_length; /* Tomar el espacio */
-				 }
-			 }else {
-				 /* El kernel no se encuentra en esta region, verificar si
-				  * su tamano es mayor que la region mas grande encontrada
-				  * hasta ahora
-				  */
-				 if (tmp_length > memory_length) {
-					 memory_start = tmp_start;
-					 memory_length = tmp_length; /* Tomar el espacio */
-				 }
-			 }
-		 }
-		} //endfor
-	}
+    /* Recorrer las regiones que inician en el mismo bloque */
+    for (; aux < &physmem[physmem_count] && 
+            aux->start / PHYSMEM_GRANULARITY == addr / PHYSMEM_GRANULARITY;
+            aux++) {
+        if (addr >= aux->start && addr < aux->start + aux->length) {
+            return aux;
+        }
+    }
+    return 0;
+}
+#endif
 
-	/* Existe una región de memoria disponible? */
-	if (memory_start > 0 && memory_length > 0) {
+#ifdef PAGING_PAE
+/**
+ * @brief Inicializa el asignador de la memoria ubicada por encima de 4 GB,
+ * a partir de las regiones detectadas por setup_memblock.
+ */
+static void physmem_setup_high(void) {
+    int i;
+    unsigned int first;
+    unsigned int last;
+    unsigned int * data;
 
-        /*
-        console_printf("Memory start at: 0x%x, length:0x%x\n", 
-                memory_start, memory_length);
-        */
+    first = PHYSMEM_HIGH_START_FRAME;
+    last = PHYSMEM_HIGH_START_FRAME;
 
-		/* Antes de retornar, establecer la minima dirección de memoria
-		 * permitida para liberar*/
+    for (i = 0; i < physmem_high_range_count; i++) {
+        if (i == 0 || physmem_high_ranges[i].start < first) {
+            first = physmem_high_ranges[i].start;
+        }
+        if (physmem_high_ranges[i].start + physmem_high_ranges[i].length 
+                > last) {
+            last = physmem_high_ranges[i].start 
+                + physmem_high_ranges[i].length;
+        }
+    }
 
-		tmp_start = memory_start;
-		/* Calcular la dirección en la cual finaliza la memoria disponible */
-		tmp_end = tmp_start + tmp_length;
+    if (physmem_high_range_count == 0) {
+        return;
+    }
 
-		/* Redondear el inicio y el fin de la región de memoria disponible a
-         * marcos */
-		tmp_end = ROUND_DOWN_TO_FRAME(tmp_end);
-		tmp_start = ROUND_UP_TO_FRAME(tmp_start);
+    /* Mapas de bits y resúmenes de acuerdo con la memoria alta detectada */
+    data = (unsigned int *)memblock_alloc(
+            (BUDDY_BITMAP_ENTRIES(last - first)
+             + BUDDY_SUMMARY_ENTRIES(last - first)) * sizeof(unsigned int));
+    if (data == 0) {
+        return;
+    }
 
-		/* Calcular el tamano de la región de memoria disponible, redondeada
-		 * a límites de página */
-		tmp_length = tmp_end - tmp_start;
+    buddy_init(&physmem_high_buddy,
+            data,
+            data + BUDDY_BITMAP_ENTRIES(last - first),
+            first,
+            last - first);
 
-		/* Actualizar las variables globales del kernel */
-		memory_start = tmp_start;
-		memory_length = tmp_length;
+    for (i = 0; i < physmem_high_range_count; i++) {
+        buddy_free(&physmem_high_buddy,
+                physmem_high_ranges[i].start,
+                physmem_high_ranges[i].length);
+    }
+}
+#endif
 
-        /* Establecer la dirección de memoria a partir de la cual se puede
-         * liberar memoria */
-		allowed_free_start = memory_start;
+/**
+ * @brief Inicializa el mapa de bits de memoria, a partir de las regiones
+ * utilizables detectadas por setup_memblock. Los mapas de bits y los
+ * descriptores de marco se reservan con el asignador temprano, con un
+ * tamaño acorde a la memoria detectada.
+ */
+void setup_physical_memory(void){
 
-        /* Inicializar las regiones de memoria disponibles */
+    int i;
+    unsigned int * tmp_ptr;
+#ifdef PHYSMEM_BUDDY
+    int zone;
+    unsigned int frames;
+    int freed;
 
-        tmp_start = memory_start; //Inicio de la memoria fisica disponible
-        tmp_end = memory_start + memory_length; //Fin de la memoria fisica
-        tmp_ptr = (unsigned int*)&physical_memory_bitmap; //Mapa de bits
+	/* Limites de la parte de cada zona que se entrega al asignador buddy */
+	unsigned int tmp_start;
+	unsigned int tmp_end;
+#else
+    int regions;
+    unsigned int entries;
+    unsigned int * tmp_summary;
+#endif
 
-        do {
-            if (tmp_start < tmp_end) {
-                physmem[physmem_count].start = tmp_start;
-                physmem[physmem_count].next = 0;
-                physmem[physmem_count].prev = 0;
-                if (physmem_count > 0) {
-                    physmem[physmem_count].prev = &physmem[physmem_count - 1];
-                    physmem[physmem_count -1].next = &physmem[physmem_count];
-                }
-                if (tmp_start + PHYSMEM_GRANULARITY < tmp_end) {
-                    physmem[physmem_count].length = 
-                        PHYSMEM_GRANULARITY;
-                }else {
-                    physmem[physmem_count].length = tmp_end - tmp_start;
-                }
+    /* Detectar las regiones de memoria utilizables, si no se ha hecho */
+    setup_memblock();
 
-                slots = physmem[physmem_count].length / FRAME_SIZE;
+    physmem_count = 0;
+    physmem_available_frames = 0;
+    physmem_frame_cache.count = 0;
 
-                /* Inicializar el mapa de bits para esta region */
-                bitmap_init(&physmem[physmem_count].map, tmp_ptr, slots);
-                tmp_ptr += slots / BITS_PER_BITMAP_ENTRY;
+#ifdef PAGING_PAE
+    physmem_setup_high();
+#endif
 
-                /* Redondear al siguiente apuntador de entero sin signo si
-                 * es necesario */
-                if (slots % BITS_PER_BITMAP_ENTRY != 0) {
-                    tmp_ptr++;
-                }
+	/* Existe alguna región de memoria disponible? */
+	if (physmem_range_count == 0) {
+        memblock_finish();
+        return;
+    }
 
-                /*
-                console_printf("0x%x (%d)\n", 
-                        physmem[physmem_count].start,
-                        physmem[physmem_count].map.free_slots);
-                */
+    /*
+    console_printf("Memory start at: 0x%x, length:0x%x\n", 
+            memory_start, memory_length);
+    */
+
+#ifdef PHYSMEM_BUDDY
+    /* Inicializar el asignador buddy de cada zona con la parte del rango
+     * que abarcan las regiones utilizables que se encuentra en la zona.
+     * Los mapas de bits se reservan con el asignador temprano, de acuerdo
+     * con el tamaño de la zona. */
+    for (zone = 0; zone < PHYSMEM_ZONES; zone++) {
+        tmp_start = memory_start;
+        if (tmp_start < physmem_zone_limits[zone]) {
+            tmp_start = physmem_zone_limits[zone];
+        }
+        tmp_end = memory_start + memory_length;
+        if (tmp_end > physmem_zone_limits[zone + 1]) {
+            tmp_end = physmem_zone_limits[zone + 1];
+        }
+        if (tmp_end < tmp_start) {
+            tmp_end = tmp_start;
+        }
 
-                physmem_count++;
-                physmem_available_frames += slots;
+        frames = (tmp_end - tmp_start) / FRAME_SIZE;
+        tmp_ptr = (unsigned int *)memblock_alloc(
+                (BUDDY_BITMAP_ENTRIES(frames) + BUDDY_SUMMARY_ENTRIES(frames))
+                * sizeof(unsigned int));
+        if (tmp_ptr == 0) {
+            physmem_range_count = 0;
+            memblock_finish();
+            return;
+        }
+
+        buddy_init(&physmem_buddy[zone],
+                tmp_ptr,
+                tmp_ptr + BUDDY_BITMAP_ENTRIES(frames),
+                tmp_start / FRAME_SIZE,
+                frames);
+    }
+#else
+    /* Reservar con el asignador temprano el mapa de bits y los resúmenes.
+     * Cada región utilizable se divide en los límites de
+     * PHYSMEM_GRANULARITY, y cada región puede requerir una entrada
+     * adicional del mapa de bits. */
+    regions = physmem_range_count + memory_length / PHYSMEM_GRANULARITY + 1;
+    if (regions > PHYSMEM_MAX_REGIONS) {
+        regions = PHYSMEM_MAX_REGIONS;
+    }
+    entries = memory_length / FRAME_SIZE / BITS_PER_BITMAP_ENTRY + regions;
+
+    tmp_ptr = (unsigned int *)memblock_alloc((entries + regions 
+                * BITMAP_SUMMARY_ENTRIES(PHYSMEM_GRANULARITY / FRAME_SIZE))
+            * sizeof(unsigned int));
+    if (tmp_ptr == 0) {
+        physmem_range_count = 0;
+        memblock_finish();
+        return;
+    }
+    tmp_summary = tmp_ptr + entries;
+    memory_bitmap = tmp_ptr;
+#endif
+
+    /* Reservar el arreglo de descriptores de marco dentro del mapa directo
+     * (PHYSMAP_SIZE en paging.h), mediante el cual se accede luego de
+     * setup_paging. */
+    frame_desc_first = memory_start / FRAME_SIZE;
+    frame_desc_count = memory_length / FRAME_SIZE;
+    frame_desc_range.length = (frame_desc_count * sizeof(frame_desc) 
+            + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+    frame_desc_range.start = memblock_alloc_phys(frame_desc_range.length,
+            PHYSMAP_SIZE);
+    if (frame_desc_range.start == 0) {
+        frame_desc_range.length = 0;
+    }
+
+    /* La memoria restante se entrega al asignador de marcos */
+    memblock_finish();
+
+#ifdef PHYSMEM_BUDDY
+    /* Liberar cada region utilizable en la zona correspondiente */
+    for (i = 0; i < physmem_range_count; i++) {
+        for (zone = 0; zone < PHYSMEM_ZONES; zone++) {
+            tmp_start = physmem_ranges[i].start;
+            if (tmp_start < physmem_zone_limits[zone]) {
+                tmp_start = physmem_zone_limits[zone];
+            }
+            tmp_end = physmem_ranges[i].start + physmem_ranges[i].length;
+            if (tmp_end > physmem_zone_limits[zone + 1]) {
+                tmp_end = physmem_zone_limits[zone + 1];
             }
-            tmp_start += PHYSMEM_GRANULARITY;
-        }while (tmp_start < tmp_end);
+            if (tmp_start < tmp_end) {
+                frames = (tmp_end - tmp_start) / FRAME_SIZE;
+                freed = buddy_free(&physmem_buddy[zone],
+                        tmp_start / FRAME_SIZE, frames);
+                /* Las regiones utilizables no se superponen, por lo cual
+                 * todos sus marcos deben quedar libres */
+                if (freed != (int)frames) {
+                    console_printf("Zone %d: only %d of %d frames freed!\n",
+                            zone, freed, frames);
+                }
+                physmem_available_frames += freed;
+            }
+        }
+    }
+#else
+    /* Inicializar las regiones de memoria de cada region utilizable */
+    for (i = 0; i <= PHYSMEM_REGION_COUNT; i++) {
+        physmem_index[i] = 0;
+    }
 
-        if (physmem_count > 0) {
-            physmem[physmem_count - 1].next = &physmem[0];
-            physmem[0].prev = &physmem[physmem_count - 1];
-            physmem_list = &physmem[0];
-            current_physmem = physmem_list;
+    for (i = 0; i < physmem_range_count; i++) {
+        physmem_add_regions(&physmem_ranges[i], &tmp_ptr, &tmp_summary);
+    }
+
+    if (physmem_count > 0) {
+        physmem[physmem_count - 1].next = &physmem[0];
+        physmem[0].prev = &physmem[physmem_count - 1];
+        physmem_list = &physmem[0];
+        current_physmem = physmem_list;
+    }
+#endif
+}
+
+/**
+ * @brief Retorna el número de marcos libres de una región utilizable.
+ */
+int available_frames_in_range(int index) {
+    int frames;
+    unsigned int end;
+#ifdef PHYSMEM_BUDDY
+    int zone;
+    unsigned int start;
+    unsigned int zone_end;
+#else
+    memory_region * aux;
+#endif
+
+    if (index < 0 || index >= physmem_range_count) {
+        return 0;
+    }
+
+#ifdef PHYSMEM_BUDDY
+    end = physmem_ranges[index].start + physmem_ranges[index].length;
+    frames = 0;
+    for (zone = 0; zone < PHYSMEM_ZONES; zone++) {
+        start = physmem_ranges[index].start;
+        if (start < physmem_zone_limits[zone]) {
+            start = physmem_zone_limits[zone];
+        }
+        zone_end = end;
+        if (zone_end > physmem_zone_limits[zone + 1]) {
+            zone_end = physmem_zone_limits[zone + 1];
+        }
+        if (start < zone_end) {
+            frames += buddy_available(&physmem_buddy[zone],
+                    start / FRAME_SIZE, (zone_end - start) / FRAME_SIZE);
         }
     }
+#else
+    end = physmem_ranges[index].start + physmem_ranges[index].length;
+    frames = 0;
+    aux = physmem_list;
+    do {
+        if (aux->start >= physmem_ranges[index].start && aux->start < end) {
+            frames += aux->map.free_slots;
+        }
+        aux = aux->next;
+    }while(aux != physmem_list);
+#endif
+
+    return frames;
 }
 
 /**
- @brief Reserva un marco libre dentro del mapa de bits de memoria.
+ * @brief Retorna el número de marcos libres de una zona de memoria, sin
+ * contar los marcos almacenados en el cache.
+ */
+int available_frames_in_zone(int zone) {
+    int frames;
+#ifndef PHYSMEM_BUDDY
+    memory_region * aux;
+#endif
+
+    if (zone < 0 || zone >= PHYSMEM_ZONES) {
+        return 0;
+    }
+
+#ifdef PHYSMEM_BUDDY
+    frames = physmem_buddy[zone].free_slots;
+#else
+    frames = 0;
+    if (physmem_count == 0) {
+        return 0;
+    }
+    aux = physmem_list;
+    do {
+        if (physmem_zone(aux->start) == zone) {
+            frames += aux->map.free_slots;
+        }
+        aux = aux->next;
+    }while(aux != physmem_list);
+#endif
+
+    return frames;
+}
+
+/**
+ @brief Reserva un marco libre de una zona dentro del mapa de bits de
+ * memoria. Si la zona no tiene marcos libres, se aplica la politica de
+ * physmem_fallback_zone.
+ * @param zone Zona de la cual se toma el marco
  * @return Dirección de inicio del marco de página, 0 si no existen marcos
  * disponibles
  */
-unsigned int allocate_frame() {
-    unsigned int addr;
+static unsigned int physmem_allocate_frame(int zone) {
     int slot;
+#ifndef PHYSMEM_BUDDY
+    unsigned int addr;
     memory_region * aux;
+#endif
 
-    aux = current_physmem;
-    
     if (physmem_available_frames == 0) {
         return 0;
     }
 
+#ifdef PHYSMEM_BUDDY
+    slot = buddy_alloc(&physmem_buddy[zone], 0);
+    if (slot >= 0) {
+        physmem_available_frames--;
+        return slot * FRAME_SIZE;
+    }
+#else
+    aux = current_physmem;
+
     do {
-        if (aux->map.free_slots != 0) {
+        if (aux->map.free_slots != 0 && physmem_zone(aux->start) == zone) {
             slot = bitmap_allocate(&aux->map);
             if (slot >= 0) {
                 addr = aux->start + (slot * FRAME_SIZE);
@@ -321,36 +571,51 @@ unsigned int allocate_frame() {
         }
         aux = aux->next;
     }while(aux != current_physmem);
-    
+#endif
+
+    zone = physmem_fallback_zone(zone, 1);
+    if (zone >= 0) {
+        return physmem_allocate_frame(zone);
+    }
+
     return 0;
 }
 
-/** 
-* @brief Reserva una región de memoria contigua libre dentro del mapa de bits
-* de memoria.
-*/
-unsigned int allocate_frame_region(unsigned int length) {
-	unsigned int frame_count;
-    unsigned int addr;
+/**
+ * @brief Reserva frame_count marcos contiguos alineados a align marcos, en
+ * una zona de memoria. Si no existe una región en la zona, se aplica la
+ * politica de physmem_fallback_zone.
+ * @return Dirección de inicio de la región, 0 si no existe
+ */
+static unsigned int physmem_allocate_region(unsigned int frame_count,
+        unsigned int align, int zone) {
     int slot;
+#ifndef PHYSMEM_BUDDY
+    unsigned int addr;
     memory_region * aux;
-
-    frame_count = (length / FRAME_SIZE);
-
-	if (length % FRAME_SIZE > 0) {
-		frame_count++;
-	}
+#endif
 
     if (physmem_available_frames < frame_count) {
         return 0;
     }
 
+#ifdef PHYSMEM_BUDDY
+    /* Las regiones del asignador buddy pueden cruzar los límites de
+     * PHYSMEM_GRANULARITY, pero no pueden ser mayores a BUDDY_MAX_BLOCK */
+    slot = buddy_alloc_region(&physmem_buddy[zone], frame_count, align);
+    if (slot >= 0) {
+        physmem_available_frames -= frame_count;
+        return slot * FRAME_SIZE;
+    }
+#else
     aux = current_physmem;
 
     do {
         if (aux->map.free_slots != 0 && 
-                aux->map.free_slots >= frame_count) {
-            slot = bitmap_allocate_region(&aux->map, frame_count);
+                aux->map.free_slots >= frame_count &&
+                physmem_zone(aux->start) == zone) {
+            slot = bitmap_allocate_aligned(&aux->map, frame_count, align,
+                    aux->start / FRAME_SIZE);
             if (slot >= 0) {
                 addr = aux->start + (slot * FRAME_SIZE);
                 physmem_available_frames -= frame_count;
@@ -359,31 +624,596 @@ unsigned int allocate_frame_region(unsigned int length) {
         }
         aux = aux->next;
     }while(aux != current_physmem);
-    
+#endif
+
+    zone = physmem_fallback_zone(zone, frame_count);
+    if (zone >= 0) {
+        return physmem_allocate_region(frame_count, align, zone);
+    }
+
     return 0;
 }
 
 /**
- * @brief Liberar un marco de página.
+ * @brief Libera un conjunto de marcos de pagina en el mapa de bits.
+ * @param addrs Direcciones de inicio de los marcos
+ * @param count Número de marcos a liberar
  */
-void free_frame(unsigned int addr) {
+static void physmem_free_frames(unsigned int * addrs, int count) {
+    int i;
+    unsigned int frame;
+#ifdef PHYSMEM_BUDDY
+    unsigned int run_start;
+    int run_count;
+
+    /* Liberar cada secuencia de marcos consecutivos con una sola llamada */
+    run_start = 0;
+    run_count = 0;
+    for (i = 0; i < count; i++) {
+        frame = addrs[i] / FRAME_SIZE;
+        if (frame * FRAME_SIZE < allowed_free_start) {
+            continue;
+        }
+        /* Una secuencia no puede cruzar el limite entre zonas */
+        if (run_count > 0 && frame == run_start + run_count &&
+                physmem_zone(frame * FRAME_SIZE) == 
+                physmem_zone(run_start * FRAME_SIZE)) {
+            run_count++;
+            continue;
+        }
+        if (run_count > 0) {
+            physmem_available_frames += buddy_free(
+                    &physmem_buddy[physmem_zone(run_start * FRAME_SIZE)],
+                    run_start, run_count);
+        }
+        run_start = frame;
+        run_count = 1;
+    }
+    if (run_count > 0) {
+        physmem_available_frames += buddy_free(
+                &physmem_buddy[physmem_zone(run_start * FRAME_SIZE)],
+                run_start, run_count);
+    }
+#else
     int slot;
-    unsigned int start;
+    int entry;
+    unsigned int mask;
+    memory_region * region;
     memory_region * aux;
 
-    start = ROUND_DOWN_TO_FRAME(addr);
-    aux = current_physmem;
+    /* Acumular los marcos que pertenecen a la misma entrada del mapa de
+     * bits, y marcarlos como libres con una sola escritura. */
+    region = 0;
+    entry = -1;
+    mask = 0;
+    for (i = 0; i < count; i++) {
+        frame = addrs[i] & ~(FRAME_SIZE - 1);
+
+        /* Reusar la region del marco anterior si es posible */
+        aux = region;
+        if (aux == 0 || frame < aux->start
+                || frame >= aux->start + aux->length) {
+            aux = physmem_find_region(frame);
+            if (aux == 0) {
+                continue;
+            }
+        }
 
-    do {
-        if (start >= aux->start && start < aux->start + aux->length) {
-            slot = (start - aux->start) / FRAME_SIZE;
-            bitmap_free(&aux->map, slot);
-            physmem_available_frames++;
+        slot = (frame - aux->start) / FRAME_SIZE;
+
+        if (aux != region || slot / BITS_PER_BITMAP_ENTRY != entry) {
+            if (mask != 0) {
+                physmem_available_frames += 
+                    bitmap_free_mask(&region->map, entry, mask);
+            }
+            region = aux;
+            entry = slot / BITS_PER_BITMAP_ENTRY;
+            mask = 0;
+        }
+        mask |= 1U << (slot % BITS_PER_BITMAP_ENTRY);
+    }
+
+    if (mask != 0) {
+        physmem_available_frames += bitmap_free_mask(&region->map, entry, mask);
+    }
+#endif
+}
+
+/**
+ * @brief Retorna el cache de marcos libres del procesador actual.
+ */
+static __inline__ frame_cache * current_frame_cache(void) {
+    return &physmem_frame_cache;
+}
+
+/**
+ * @brief Verifica si un marco se encuentra gestionado y asignado, y por lo
+ * tanto puede ser liberado.
+ * @param start Dirección del marco, alineada a FRAME_SIZE
+ * @return 1 si el marco se puede liberar, 0 en caso contrario
+ */
+static int physmem_is_allocated(unsigned int start) {
+#ifdef PHYSMEM_BUDDY
+    if (start < allowed_free_start || start < memory_start 
+            || start - memory_start >= memory_length) {
+        return 0;
+    }
+    return buddy_available(&physmem_buddy[physmem_zone(start)],
+            start / FRAME_SIZE, 1) == 0;
+#else
+    memory_region * aux;
+
+    aux = physmem_find_region(start);
+    if (aux == 0) {
+        return 0;
+    }
+    return !bitmap_test(&aux->map, (start - aux->start) / FRAME_SIZE);
+#endif
+}
+
+/**
+ * @brief Verifica si un marco ya se encuentra en el cache. Los marcos del
+ * cache siguen marcados como asignados en el mapa de bits, por lo cual
+ * physmem_is_allocated no detecta que ya fueron liberados.
+ * @param cache Cache en el cual se busca el marco
+ * @param start Dirección del marco, alineada a FRAME_SIZE
+ * @return 1 si el marco se encuentra en el cache, 0 en caso contrario
+ */
+static int frame_cache_contains(frame_cache * cache, unsigned int start) {
+    int i;
+
+    for (i = 0; i < cache->count; i++) {
+        if (cache->frames[i] == start) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Toma hasta FRAME_CACHE_BATCH marcos del mapa de bits y los
+ * almacena en el cache.
+ * @param cache Cache a recargar
+ */
+static void frame_cache_refill(frame_cache * cache) {
+    unsigned int frame;
+#ifdef PHYSMEM_BUDDY
+    int slot;
+    int i;
+
+    /* Tomar un bloque completo del asignador buddy si es posible */
+    slot = buddy_alloc(&physmem_buddy[PHYSMEM_ZONE_NORMAL],
+            FRAME_CACHE_BATCH_ORDER);
+    if (slot >= 0) {
+        physmem_available_frames -= FRAME_CACHE_BATCH;
+        /* Apilar en orden inverso, para entregar primero el marco menor */
+        for (i = FRAME_CACHE_BATCH - 1; i >= 0; i--) {
+            cache->frames[cache->count++] = (slot + i) * FRAME_SIZE;
+        }
+        return;
+    }
+#endif
+
+    while (cache->count < FRAME_CACHE_BATCH) {
+        frame = physmem_allocate_frame(PHYSMEM_ZONE_NORMAL);
+        if (frame == 0) {
             return;
         }
-        aux = aux->next;
-    }while(aux != current_physmem);
-    //console_printf("Frame at 0x%x not found!\n");
+        cache->frames[cache->count++] = frame;
+    }
+}
+
+/**
+ * @brief Devuelve al mapa de bits los count marcos mas antiguos del cache
+ * @param cache Cache a vaciar
+ * @param count Número de marcos a devolver
+ */
+static void frame_cache_drain(frame_cache * cache, int count) {
+    int i;
+
+    if (count > cache->count) {
+        count = cache->count;
+    }
+
+    /* Los marcos mas antiguos se encuentran al inicio del arreglo */
+    physmem_free_frames(cache->frames, count);
+
+    for (i = count; i < cache->count; i++) {
+        cache->frames[i - count] = cache->frames[i];
+    }
+    cache->count -= count;
+}
+
+/**
+ * @brief Marca como asignados (una referencia) los descriptores de count
+ * marcos consecutivos.
+ * @param addr Dirección del primer marco
+ * @param count Número de marcos
+ */
+static void frame_desc_acquire(unsigned int addr, unsigned int count) {
+    frame_desc * desc;
+
+    desc = get_frame_desc(addr);
+    if (desc == 0) {
+        return;
+    }
+
+    for (; count > 0; count--, desc++) {
+        desc->refcount = 1;
+        desc->flags = 0;
+    }
+}
+
+/**
+ * @brief Libera una referencia de un marco.
+ * @param addr Dirección del marco
+ * @return 1 si el marco ya no tiene referencias y se debe devolver al
+ * asignador, 0 en caso contrario
+ */
+static int frame_desc_release(unsigned int addr) {
+    frame_desc * desc;
+
+    desc = get_frame_desc(addr);
+    if (desc == 0) {
+        return 1;
+    }
+
+    /* Los marcos reservados y los que ya están libres (en el asignador o
+     * en el cache) no tienen referencias que liberar */
+    if ((desc->flags & FRAME_DESC_RESERVED) || desc->refcount == 0) {
+        return 0;
+    }
+
+    if (desc->refcount > 1) {
+        desc->refcount--;
+        return 0;
+    }
+
+    desc->refcount = 0;
+    desc->flags = 0;
+    return 1;
+}
+
+/**
+ * @brief Verifica si un marco se debe devolver al asignador: debe estar
+ * asignado, y se debe liberar su última referencia. Los marcos del cache
+ * siguen asignados en el mapa de bits pero su descriptor no tiene
+ * referencias; si aún no existen descriptores, se buscan en el cache.
+ * @param cache Cache de marcos libres del procesador actual
+ * @param addr Dirección del marco, alineada a FRAME_SIZE
+ * @return 1 si el marco se debe liberar, 0 en caso contrario
+ */
+static int frame_release(frame_cache * cache, unsigned int addr) {
+    if (!physmem_is_allocated(addr)) {
+        return 0;
+    }
+    if (get_frame_desc(addr) == 0) {
+        return !frame_cache_contains(cache, addr);
+    }
+    return frame_desc_release(addr);
+}
+
+/**
+ * @brief Inicializa los descriptores de marco.
+ */
+void setup_frame_descriptors(void) {
+    unsigned int i;
+    unsigned int frame;
+    unsigned int end;
+    int r;
+    frame_desc * desc;
+
+    if (frame_desc_range.length == 0 || frame_desc_count == 0) {
+        console_printf("Frame descriptors: not available\n");
+        return;
+    }
+
+    desc = (frame_desc *)phys_to_virt(frame_desc_range.start);
+
+    /* Los marcos del cache se encuentran asignados en el mapa de bits:
+     * devolverlos para que su descriptor indique que están libres */
+    flush_frame_cache();
+
+    /* Los huecos entre regiones y el propio arreglo quedan reservados */
+    for (i = 0; i < frame_desc_count; i++) {
+        desc[i].refcount = 0;
+        desc[i].flags = FRAME_DESC_RESERVED;
+        desc[i].lru_prev = 0;
+        desc[i].lru_next = 0;
+    }
+
+    /* Los marcos de las regiones utilizables tienen una referencia si ya
+     * fueron asignados (tablas de página, mapa directo, etc.) */
+    for (r = 0; r < physmem_range_count; r++) {
+        frame = physmem_ranges[r].start / FRAME_SIZE;
+        end = frame + physmem_ranges[r].length / FRAME_SIZE;
+        for (; frame < end; frame++) {
+            i = frame - frame_desc_first;
+            desc[i].flags = 0;
+            desc[i].refcount = physmem_is_allocated(frame * FRAME_SIZE);
+        }
+    }
+
+    frame_descs = desc;
+
+    console_printf("Frame descriptors: %d frames, %d bytes/frame, %d KB\n",
+            frame_desc_count, sizeof(frame_desc),
+            frame_desc_range.length / 1024);
+}
+
+/**
+ * @brief Obtiene el descriptor de un marco de página.
+ */
+frame_desc * get_frame_desc(unsigned int addr) {
+    unsigned int frame;
+
+    frame = addr / FRAME_SIZE;
+    if (frame_descs == 0 || frame < frame_desc_first
+            || frame - frame_desc_first >= frame_desc_count) {
+        return 0;
+    }
+    return &frame_descs[frame - frame_desc_first];
+}
+
+/**
+ * @brief Agrega una referencia a un marco asignado.
+ */
+int share_frame(unsigned int addr) {
+    frame_desc * desc;
+    unsigned int flags;
+    int count;
+
+    flags = disable_interrupts();
+
+    count = 0;
+    desc = get_frame_desc(addr);
+    if (desc != 0 && desc->refcount > 0 && desc->refcount < 0xFFFF
+            && !(desc->flags & FRAME_DESC_RESERVED)) {
+        count = ++desc->refcount;
+    }
+
+    restore_interrupts(flags);
+
+    return count;
+}
+
+/**
+ * @brief Reserva un marco libre, a partir del cache de marcos libres.
+ * @return Dirección de inicio del marco de página, 0 si no existen marcos
+ * disponibles
+ */
+unsigned int allocate_frame() {
+    unsigned int frame;
+    unsigned int flags;
+    frame_cache * cache;
+
+    flags = disable_interrupts();
+
+    cache = current_frame_cache();
+
+    if (cache->count == 0) {
+        frame_cache_refill(cache);
+    }
+
+    frame = 0;
+    if (cache->count > 0) {
+        frame = cache->frames[--cache->count];
+        frame_desc_acquire(frame, 1);
+    }
+
+    restore_interrupts(flags);
+
+    return frame;
+}
+
+/** 
+* @brief Reserva una región de memoria contigua libre dentro del mapa de bits
+* de memoria.
+*/
+unsigned int allocate_frame_region(unsigned int length) {
+    return allocate_frame_region_aligned(length, FRAME_SIZE);
+}
+
+/** 
+* @brief Reserva una región de memoria contigua libre, cuya dirección de
+* inicio es múltiplo de alignment.
+*/
+unsigned int allocate_frame_region_aligned(unsigned int length,
+        unsigned int alignment) {
+    return allocate_frame_region_zone(length, alignment, PHYSMEM_ZONE_NORMAL);
+}
+
+/**
+ * @brief Reserva un marco libre de una zona de memoria.
+ */
+unsigned int allocate_frame_zone(int zone) {
+    unsigned int frame;
+    unsigned int flags;
+
+    /* Los marcos del cache se toman de la zona normal */
+    if (zone == PHYSMEM_ZONE_NORMAL) {
+        return allocate_frame();
+    }
+
+    if (zone < 0 || zone >= PHYSMEM_ZONES) {
+        return 0;
+    }
+
+    flags = disable_interrupts();
+
+    frame = physmem_allocate_frame(zone);
+
+    /* El cache puede contener marcos de la zona: devolverlos e intentar
+     * de nuevo */
+    if (frame == 0 && current_frame_cache()->count > 0) {
+        flush_frame_cache();
+        frame = physmem_allocate_frame(zone);
+    }
+
+    if (frame != 0) {
+        frame_desc_acquire(frame, 1);
+    }
+
+    restore_interrupts(flags);
+
+    return frame;
+}
+
+/** 
+* @brief Reserva una región de memoria contigua libre de una zona, cuya
+* dirección de inicio es múltiplo de alignment.
+*/
+unsigned int allocate_frame_region_zone(unsigned int length,
+        unsigned int alignment, int zone) {
+	unsigned int frame_count;
+    unsigned int align;
+    unsigned int addr;
+    unsigned int flags;
+
+    frame_count = (length / FRAME_SIZE);
+
+	if (length % FRAME_SIZE > 0) {
+		frame_count++;
+	}
+
+    /* Alineación en marcos, como mínimo un marco */
+    align = alignment / FRAME_SIZE;
+    if (align == 0) {
+        align = 1;
+    }
+
+    if (frame_count == 0 || available_frames() < frame_count ||
+            zone < 0 || zone >= PHYSMEM_ZONES) {
+        return 0;
+    }
+
+    flags = disable_interrupts();
+
+    addr = physmem_allocate_region(frame_count, align, zone);
+
+    /* Los marcos del cache pueden impedir encontrar una region contigua:
+     * devolverlos al mapa de bits e intentar de nuevo. */
+    if (addr == 0 && current_frame_cache()->count > 0) {
+        flush_frame_cache();
+        addr = physmem_allocate_region(frame_count, align, zone);
+    }
+
+    if (addr != 0) {
+        frame_desc_acquire(addr, frame_count);
+    }
+
+    restore_interrupts(flags);
+
+    return addr;
+}
+
+/**
+ * @brief Liberar un marco de página. El marco se almacena en el cache de
+ * marcos libres, y se devuelve al mapa de bits cuando el cache se llena.
+ */
+void free_frame(unsigned int addr) {
+    unsigned int start;
+    unsigned int flags;
+    frame_cache * cache;
+
+    start = ROUND_DOWN_TO_FRAME(addr);
+
+    flags = disable_interrupts();
+
+    cache = current_frame_cache();
+
+    /* Solo se liberan los marcos gestionados que no estaban libres, ni
+     * en el mapa de bits ni en el cache, cuando se libera su última
+     * referencia */
+    if (frame_release(cache, start)) {
+        if (cache->count == FRAME_CACHE_SIZE) {
+            frame_cache_drain(cache, FRAME_CACHE_BATCH);
+        }
+        cache->frames[cache->count++] = start;
+    }
+    //else console_printf("Frame at 0x%x not found!\n");
+
+    restore_interrupts(flags);
+}
+
+/**
+ * @brief Libera un conjunto de marcos de pagina.
+ */
+void free_frames(unsigned int * addrs, int count) {
+    unsigned int batch[FRAME_CACHE_BATCH];
+    unsigned int flags;
+    frame_cache * cache;
+    int n;
+    int i;
+
+    flags = disable_interrupts();
+
+    cache = current_frame_cache();
+
+    if (frame_descs == 0) {
+        /* Un marco que ya se encuentra en el cache sigue marcado como
+         * asignado, y se liberaría dos veces. Al vaciar primero el cache,
+         * el mapa de bits ignora los marcos que ya estaban libres. */
+        frame_cache_drain(cache, cache->count);
+        physmem_free_frames(addrs, count);
+        restore_interrupts(flags);
+        return;
+    }
+
+    /* Devolver al asignador solo los marcos sin referencias, en grupos */
+    n = 0;
+    for (i = 0; i < count; i++) {
+        if (!frame_release(cache, addrs[i] & ~(FRAME_SIZE - 1))) {
+            continue;
+        }
+        batch[n++] = addrs[i];
+        if (n == FRAME_CACHE_BATCH) {
+            physmem_free_frames(batch, n);
+            n = 0;
+        }
+    }
+    if (n > 0) {
+        physmem_free_frames(batch, n);
+    }
+
+    restore_interrupts(flags);
+}
+
+/**
+ * @brief Libera una región de marcos contiguos.
+ */
+void free_frame_region(unsigned int addr, unsigned int length) {
+    unsigned int frames[FRAME_CACHE_BATCH];
+    unsigned int start;
+    unsigned int end;
+    int count;
+
+    start = addr & ~(FRAME_SIZE - 1);
+    end = start + length;
+
+    /* Liberar los marcos en grupos, para escribir cada entrada del mapa de
+     * bits una sola vez */
+    while (start < end) {
+        for (count = 0; count < FRAME_CACHE_BATCH && start < end;
+                count++, start += FRAME_SIZE) {
+            frames[count] = start;
+        }
+        free_frames(frames, count);
+    }
+}
+
+/**
+ * @brief Devuelve al mapa de bits todos los marcos del cache de marcos
+ * libres.
+ */
+void flush_frame_cache(void) {
+    unsigned int flags;
+    frame_cache * cache;
+
+    flags = disable_interrupts();
+    cache = current_frame_cache();
+    frame_cache_drain(cache, cache->count);
+    restore_interrupts(flags);
 }
 
 /**
@@ -391,7 +1221,52 @@ void free_frame(unsigned int addr) {
  * @return Número de marcos de página disponibles
  */
 int available_frames() {
-    return physmem_available_frames;
+    return physmem_available_frames + current_frame_cache()->count;
 }
 
+/**
+ * @brief Reserva un marco de página ubicado por encima de 4 GB.
+ */
+unsigned int allocate_high_frame(void) {
+#ifdef PAGING_PAE
+    int slot;
+    unsigned int flags;
+
+    flags = disable_interrupts();
+    slot = buddy_alloc(&physmem_high_buddy, 0);
+    restore_interrupts(flags);
 
+    if (slot >= 0) {
+        return slot;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * @brief Libera un marco de página indicado por su número.
+ */
+void free_frame_number(unsigned int frame) {
+#ifdef PAGING_PAE
+    unsigned int flags;
+
+    if (frame >= PHYSMEM_HIGH_START_FRAME) {
+        flags = disable_interrupts();
+        buddy_free(&physmem_high_buddy, frame, 1);
+        restore_interrupts(flags);
+        return;
+    }
+#endif
+    free_frame(frame * FRAME_SIZE);
+}
+
+/**
+ * @brief Retorna el número de marcos libres por encima de 4 GB.
+ */
+int available_high_frames(void) {
+#ifdef PAGING_PAE
+    return physmem_high_buddy.free_slots;
+#else
+    return 0;
+#endif
+}